@@ -129,6 +129,8 @@ static int tb_paint(int argv, char** argc)
     tb_init();
 
     tb_select_input_mode(TB_INPUT_ESC | TB_INPUT_MOUSE);
+    tb_select_event_mask(TB_SUBSCRIBE_KEY | TB_SUBSCRIBE_PRESS | TB_SUBSCRIBE_MOTION |
+        TB_SUBSCRIBE_COALESCE);
     int w = tb_width();
     int h = tb_height();
     reallocBackBuffer(w, h);
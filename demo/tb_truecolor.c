@@ -16,7 +16,7 @@ static int tb_truecolor()
         {
             uint32_t ch;
             utf8_char_to_unicode(&ch, "x");
-            fg = 0;
+            fg = TB_TRUECOLOR_BLACK;
 
             if (z % 2 == 0)
             {
@@ -33,7 +33,7 @@ static int tb_truecolor()
                 fg |= TB_REVERSE;
             }
 
-            tb_change_cell(x, y, ch, fg, bg);
+            tb_change_cell(x, y, ch, fg, bg ? bg : TB_TRUECOLOR_BLACK); /* 0 is the default colour */
             bg += 0x000101;
             z++;
         }
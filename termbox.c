@@ -10,6 +10,7 @@
 
 #include <stddef.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <sys/ioctl.h>
@@ -31,6 +32,10 @@ struct memstream
     size_t capa;
     int file;
     unsigned char* data;
+
+    uint32_t flush_count;
+    uint32_t overflow_count; // flushes forced by a full buffer
+    uint32_t bytes_written;
 };
 
 static void memstream_init(struct memstream* s, int fd, void* buffer, size_t len)
@@ -39,11 +44,21 @@ static void memstream_init(struct memstream* s, int fd, void* buffer, size_t len
     s->data = buffer;
     s->pos = 0;
     s->capa = len;
+    s->flush_count = 0;
+    s->overflow_count = 0;
+    s->bytes_written = 0;
 }
 
 static void memstream_flush(struct memstream* s)
 {
-    write(s->file, s->data, s->pos);
+    // a negative descriptor is a null sink, only the counters are kept
+    if (s->file >= 0)
+    {
+        write(s->file, s->data, s->pos);
+    }
+
+    s->flush_count++;
+    s->bytes_written += s->pos;
     s->pos = 0;
 }
 
@@ -53,6 +68,7 @@ static void memstream_write(struct memstream* s, void* source, size_t len)
 
     if (s->pos + len > s->capa)
     {
+        s->overflow_count++;
         memstream_flush(s);
     }
 
@@ -60,40 +76,84 @@ static void memstream_write(struct memstream* s, void* source, size_t len)
     s->pos += len;
 }
 
+// make room for 'len' bytes and return where they go, the caller moves pos
+static unsigned char* memstream_reserve(struct memstream* s, size_t len)
+{
+    if (s->pos + len > s->capa)
+    {
+        s->overflow_count++;
+        memstream_flush(s);
+    }
+
+    return s->data + s->pos;
+}
+
 static void memstream_puts(struct memstream* s, const char* str)
 {
     memstream_write(s, (void*) str, strlen(str));
 }
 
 /*---------------------ringbuffer---------------------------*/
+/*
+ * Single-producer/single-consumer byte ring. 'head' is only written by the
+ * producer and 'tail' only by the consumer; both grow monotonically and are
+ * masked with 'size - 1' (size is a power of two) to get the buffer offset,
+ * so 'head - tail' is always the number of queued bytes, even across
+ * wrap-around of size_t. A reader thread or a UART RX interrupt can push
+ * while the UI thread pops without taking a lock.
+ */
 #define ERINGBUFFER_ALLOC_FAIL -1
 
+#if defined(__GNUC__) || defined(__clang__)
+#define RB_LOAD_ACQUIRE(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RB_STORE_RELEASE(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+/* single core MCUs: a volatile access keeps the compiler from reordering */
+#define RB_LOAD_ACQUIRE(p)      (*(volatile size_t*)(p))
+#define RB_STORE_RELEASE(p, v)  (*(volatile size_t*)(p) = (v))
+#endif
+
 struct ringbuffer
 {
     char* buf;
     size_t size;
+    size_t mask;
+
+    size_t head; // producer index
+    size_t tail; // consumer index
 
-    char* begin;
-    char* end;
+    size_t high_water; // max bytes ever held
+    size_t dropped; // bytes discarded because the buffer was full
 };
 
+// consumer side: discard everything queued so far
 static void clear_ringbuffer(struct ringbuffer* r)
 {
-    r->begin = 0;
-    r->end = 0;
+    RB_STORE_RELEASE(&r->tail, RB_LOAD_ACQUIRE(&r->head));
 }
 
 static int init_ringbuffer(struct ringbuffer* r, size_t size)
 {
-    r->buf = (char*)rt_malloc(size);
+    size_t capa = 1;
+
+    while (capa < size)
+    {
+        capa <<= 1;
+    }
+
+    r->buf = (char*)rt_malloc(capa);
     if (r->buf == RT_NULL)
     {
         LOG_E("init_ringbuffer malloc error!");
         return ERINGBUFFER_ALLOC_FAIL;
     }
 
-    r->size = size;
+    r->size = capa;
+    r->mask = capa - 1;
+    r->head = 0;
     clear_ringbuffer(r);
+    r->high_water = 0;
+    r->dropped = 0;
 
     return 0;
 }
@@ -101,182 +161,200 @@ static int init_ringbuffer(struct ringbuffer* r, size_t size)
 static void free_ringbuffer(struct ringbuffer* r)
 {
     rt_free(r->buf);
+    r->buf = RT_NULL;
 }
 
 static size_t ringbuffer_free_space(struct ringbuffer* r)
 {
-    if (r->begin == 0 && r->end == 0)
-    {
-        return r->size;
-    }
-
-    if (r->begin < r->end)
-    {
-        return r->size - (r->end - r->begin) - 1;
-    }
-    else
-    {
-        return r->begin - r->end - 1;
-    }
+    return r->size - (RB_LOAD_ACQUIRE(&r->head) - RB_LOAD_ACQUIRE(&r->tail));
 }
 
 static size_t ringbuffer_data_size(struct ringbuffer* r)
 {
-    if (r->begin == 0 && r->end == 0)
+    return RB_LOAD_ACQUIRE(&r->head) - RB_LOAD_ACQUIRE(&r->tail);
+}
+
+// producer side: returns the number of bytes queued, which is less than
+// 'size' only when the buffer is full
+static size_t ringbuffer_push(struct ringbuffer* r, const void* data, size_t size)
+{
+    size_t head = r->head;
+    size_t used = head - RB_LOAD_ACQUIRE(&r->tail);
+    size_t space = r->size - used;
+    size_t off, first;
+
+    if (size > space)
     {
-        return 0;
+        r->dropped += size - space;
+        size = space;
     }
 
-    if (r->begin <= r->end)
+    off = head & r->mask;
+    first = r->size - off;
+
+    if (first > size)
     {
-        return r->end - r->begin + 1;
+        first = size;
     }
-    else
+
+    rt_memcpy(r->buf + off, data, first);
+    rt_memcpy(r->buf, (const char*)data + first, size - first);
+    RB_STORE_RELEASE(&r->head, head + size);
+
+    if (used + size > r->high_water)
     {
-        return r->size - (r->begin - r->end) + 1;
+        r->high_water = used + size;
     }
-}
 
+    return size;
+}
 
-static void ringbuffer_push(struct ringbuffer* r, const void* data, size_t size)
+// consumer side: copy 'size' bytes out without consuming them
+static void ringbuffer_read(struct ringbuffer* r, void* data, size_t size)
 {
-    if (ringbuffer_free_space(r) < size)
-    {
-        return;
-    }
+    size_t tail = r->tail;
+    size_t off, first;
 
-    if (r->begin == 0 && r->end == 0)
+    if (RB_LOAD_ACQUIRE(&r->head) - tail < size)
     {
-        rt_memcpy(r->buf, data, size);
-        r->begin = r->buf;
-        r->end = r->buf + size - 1;
         return;
     }
 
-    r->end++;
+    off = tail & r->mask;
+    first = r->size - off;
 
-    if (r->begin < r->end)
-    {
-        if ((size_t)(r->buf + (ptrdiff_t)r->size - r->begin) >= size)
-        {
-            // we can fit without cut
-            rt_memcpy(r->end, data, size);
-            r->end += size - 1;
-        }
-        else
-        {
-            // make a cut
-            size_t s = r->buf + r->size - r->end;
-            rt_memcpy(r->end, data, s);
-            size -= s;
-            rt_memcpy(r->buf, (char*)data + s, size);
-            r->end = r->buf + size - 1;
-        }
-    }
-    else
+    if (first > size)
     {
-        rt_memcpy(r->end, data, size);
-        r->end += size - 1;
+        first = size;
     }
+
+    rt_memcpy(data, r->buf + off, first);
+    rt_memcpy((char*)data + first, r->buf, size - first);
+}
+
+// consumer side: the byte at offset 'off' from the oldest queued byte
+static char ringbuffer_at(struct ringbuffer* r, size_t off)
+{
+    return r->buf[(r->tail + off) & r->mask];
 }
 
+// consumer side: consume 'size' bytes, copying them to 'data' if not null
 static void ringbuffer_pop(struct ringbuffer* r, void* data, size_t size)
 {
-    if (ringbuffer_data_size(r) < size)
+    if (RB_LOAD_ACQUIRE(&r->head) - r->tail < size)
     {
         return;
     }
 
-    int need_clear = 0;
-
-    if (ringbuffer_data_size(r) == size)
+    if (data)
     {
-        need_clear = 1;
+        ringbuffer_read(r, data, size);
     }
 
-    if (r->begin < r->end)
-    {
-        if (data)
-        {
-            rt_memcpy(data, r->begin, size);
-        }
-
-        r->begin += size;
-    }
-    else
-    {
-        if ((size_t)(r->buf + (ptrdiff_t)r->size - r->begin) >= size)
-        {
-            if (data)
-            {
-                rt_memcpy(data, r->begin, size);
-            }
+    RB_STORE_RELEASE(&r->tail, r->tail + size);
+}
 
-            r->begin += size;
-        }
-        else
-        {
-            size_t s = r->buf + r->size - r->begin;
+/*---------------------utf8---------------------------*/
+/*
+ * Validating UTF-8 decoder after Bjoern Hoehrmann's DFA
+ * (http://bjoern.hoehrmann.de/utf-8/decoder/dfa/): the first 256 entries map
+ * a byte to its class, the rest map state + class to the next state. Overlong
+ * forms, surrogates and code points above U+10FFFF are rejected.
+ */
+#define UTF8_ACCEPT 0
+#define UTF8_REJECT 12
 
-            if (data)
-            {
-                rt_memcpy(data, r->begin, s);
-            }
+static const uint8_t utf8_dfa[] =
+{
+    // byte classes
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 00..1f
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 20..3f
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 40..5f
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 60..7f
+    1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9, // 80..9f
+    7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7, // a0..bf
+    8,8,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2, // c0..df
+    10,3,3,3,3,3,3,3,3,3,3,3,3,4,3,3,11,6,6,6,5,8,8,8,8,8,8,8,8,8,8,8, // e0..ff
+
+    // transitions
+    0,12,24,36,60,96,84,12,12,12,48,72, 12,12,12,12,12,12,12,12,12,12,12,12,
+    12,0,12,12,12,12,12,0,12,0,12,12, 12,24,12,12,12,12,12,24,12,24,12,12,
+    12,12,12,12,12,12,12,24,12,12,12,12, 12,24,12,12,12,12,12,12,12,24,12,12,
+    12,12,12,12,12,12,12,36,12,36,12,12, 12,36,12,12,12,12,12,36,12,36,12,12,
+    12,36,12,12,12,12,12,12,12,12,12,12,
+};
 
-            size -= s;
+// feed one byte, returns the new state; '*cp' is complete on UTF8_ACCEPT
+rt_inline uint32_t utf8_step(uint32_t state, uint32_t* cp, unsigned char byte)
+{
+    uint32_t type = utf8_dfa[byte];
 
-            if (data)
-            {
-                rt_memcpy((char*)data + s, r->buf, size);
-            }
+    *cp = (state != UTF8_ACCEPT) ? (byte & 0x3Fu) | (*cp << 6) : (0xFFu >> type) & byte;
+    return utf8_dfa[256 + state + type];
+}
 
-            r->begin = r->buf + size;
-        }
-    }
+/*
+ * Decode one character from at most 'len' bytes, returns the number of bytes
+ * consumed (at least 1). Malformed input decodes to U+FFFD, one for every
+ * maximal invalid subpart, as the Unicode standard recommends: a byte which
+ * cannot continue a sequence is not consumed but starts the next one.
+ */
+static int utf8_decode(uint32_t* out, const unsigned char* s, size_t len)
+{
+    uint32_t state = UTF8_ACCEPT;
+    size_t i;
 
-    if (need_clear)
+    if (s[0] < 0x80)
     {
-        clear_ringbuffer(r);
+        *out = s[0];
+        return 1;
     }
-}
 
-static void ringbuffer_read(struct ringbuffer* r, void* data, size_t size)
-{
-    if (ringbuffer_data_size(r) < size)
+    // every state past UTF8_REJECT is in the middle of a character
+    state = utf8_step(state, out, s[0]);
+    for (i = 1; state > UTF8_REJECT && i < len; i++)
     {
-        return;
+        state = utf8_step(state, out, s[i]);
     }
 
-    if (r->begin < r->end)
+    if (state == UTF8_ACCEPT)
     {
-        rt_memcpy(data, r->begin, size);
+        return (int)i;
     }
-    else
+
+    // invalid, or truncated at the end of the input
+    *out = 0xFFFD;
+    return state == UTF8_REJECT && i > 1 ? (int)i - 1 : (int)i;
+}
+
+#define UTF8_PRINTABLE(c) ((c) >= 0x20 && (c) < 0x7F)
+
+// length of the run of printable ASCII bytes (one column each) 's' starts
+// with, checked a word at a time
+static size_t utf8_print_run(const unsigned char* s, size_t len)
+{
+    const size_t ones = (size_t)-1 / 0xFF; // 0x01 in every byte
+    const size_t high = ones * 0x80;
+    size_t i = 0, word;
+
+    for (; i + sizeof(size_t) <= len; i += sizeof(size_t))
     {
-        if ((size_t)(r->buf + (ptrdiff_t)r->size - r->begin) >= size)
-        {
-            rt_memcpy(data, r->begin, size);
-        }
-        else
+        rt_memcpy(&word, s + i, sizeof(size_t));
+
+        // any byte >= 0x80, < 0x20 or == 0x7F
+        if ((word | ((word - ones * 0x20) & ~word) | ((word ^ ones * 0x7F) - ones)) & high)
         {
-            size_t s = r->buf + r->size - r->begin;
-            rt_memcpy(data, r->begin, s);
-            size -= s;
-            rt_memcpy((char*)data + s, r->buf, size);
+            break;
         }
     }
-}
 
-/*---------------------utf8---------------------------*/
-static const unsigned char utf8_mask[6] =
-{
-    0x7F,
-    0x1F,
-    0x0F,
-    0x07,
-    0x03,
-    0x01
-};
+    while (i < len && UTF8_PRINTABLE(s[i]))
+    {
+        i++;
+    }
+
+    return i;
+}
 
 #if 0
 static const char utf8len_tab[256] = {
@@ -313,24 +391,37 @@ int utf8_char_length(char c)
 
 int utf8_char_to_unicode(uint32_t* out, const char* c)
 {
+    const unsigned char* s = (const unsigned char*)c;
+    uint32_t state = UTF8_ACCEPT;
+    int i;
+
     if (*c == 0)
     {
         return TB_EOF;
     }
 
-    int i;
-    unsigned char len = utf8_char_length(*c);
-    unsigned char mask = utf8_mask[len - 1];
-    uint32_t result = c[0] & mask;
-
-    for (i = 1; i < len; ++i)
+    if (s[0] < 0x80)
     {
-        result <<= 6;
-        result |= c[i] & 0x3f;
+        *out = s[0];
+        return 1;
     }
 
-    *out = result;
-    return (int)len;
+    // the terminating NUL can't continue a sequence, so it is never passed
+    for (i = 0; ; i++)
+    {
+        state = utf8_step(state, out, s[i]);
+
+        if (state == UTF8_ACCEPT)
+        {
+            return i + 1;
+        }
+
+        if (state == UTF8_REJECT)
+        {
+            *out = 0xFFFD;
+            return i == 0 ? 1 : i;
+        }
+    }
 }
 
 int utf8_unicode_to_char(char* out, uint32_t c)
@@ -381,6 +472,37 @@ int utf8_unicode_to_char(char* out, uint32_t c)
     return len;
 }
 
+// 'c' beyond ASCII as UTF-8, one branch per length; code points the cells
+// can't hold are sent as U+FFFD
+rt_inline int utf8_encode(unsigned char* out, uint32_t c)
+{
+    if (c < 0x800)
+    {
+        out[0] = (unsigned char)(0xC0 | c >> 6);
+        out[1] = (unsigned char)(0x80 | (c & 0x3F));
+        return 2;
+    }
+
+    if (c > 0x10FFFF)
+    {
+        c = 0xFFFD;
+    }
+
+    if (c < 0x10000)
+    {
+        out[0] = (unsigned char)(0xE0 | c >> 12);
+        out[1] = (unsigned char)(0x80 | (c >> 6 & 0x3F));
+        out[2] = (unsigned char)(0x80 | (c & 0x3F));
+        return 3;
+    }
+
+    out[0] = (unsigned char)(0xF0 | c >> 18);
+    out[1] = (unsigned char)(0x80 | (c >> 12 & 0x3F));
+    out[2] = (unsigned char)(0x80 | (c >> 6 & 0x3F));
+    out[3] = (unsigned char)(0x80 | (c & 0x3F));
+    return 4;
+}
+
 /*---------------------term---------------------------*/
 enum
 {
@@ -398,11 +520,18 @@ enum
     T_EXIT_KEYPAD,
     T_ENTER_MOUSE,
     T_EXIT_MOUSE,
+    T_ENTER_PASTE,
+    T_EXIT_PASTE,
+    T_ENTER_CSIU,
+    T_EXIT_CSIU,
     T_FUNCS_NUM,
 };
 
 #define ENTER_MOUSE_SEQ "\x1b[?1000h\x1b[?1002h\x1b[?1015h\x1b[?1006h"
 #define EXIT_MOUSE_SEQ "\x1b[?1006l\x1b[?1015l\x1b[?1002l\x1b[?1000l"
+// kitty keyboard flags 1 (disambiguate) + 2 (event types), modifyOtherKeys 2
+#define ENTER_CSIU_SEQ "\x1b[>3u\x1b[>4;2m"
+#define EXIT_CSIU_SEQ "\x1b[<u\x1b[>4;0m"
 
 // rxvt-256color
 // static const char* rxvt_256color_keys[] =
@@ -491,332 +620,183 @@ static const char* xterm_funcs[] =
     "\033[?1049h", "\033[?1049l", "\033[?12l\033[?25h", "\033[?25l",
     "\033[H\033[2J", "\033(B\033[m", "\033[4m", "\033[1m", "\033[5m", "\033[7m",
     "\033[?1h\033=", "\033[?1l\033>", ENTER_MOUSE_SEQ, EXIT_MOUSE_SEQ,
+    "\033[?2004h", "\033[?2004l", ENTER_CSIU_SEQ, EXIT_CSIU_SEQ,
 };
 
 static const char** keys;
 static const char** funcs;
 
-static int init_term(void)
-{
-    /* PuTTY supports sterm by default, which can let you to use mouse */
-    keys = xterm_keys;
-    funcs = xterm_funcs;
-    return 0;
-}
+/*
+ * Prefix trie of the active key table, built once by init_term(). Children
+ * of a node are kept in a singly linked sibling list; index 0 is the root and
+ * doubles as the "no node" marker since the root is never anyone's child.
+ */
+#ifndef TB_KEY_TRIE_NODES
+#define TB_KEY_TRIE_NODES 128
+#endif
 
-/*---------------------input---------------------------*/
-#define BUFFER_SIZE_MAX 16
+#define KEY_TRIE_NONE 0xFF
 
-// if s1 starts with s2 returns 1, else 0
-static int starts_with(const char* s1, const char* s2)
+struct key_trie_node
 {
-    while (*s2)
-    {
-        if (*s1++ != *s2++)
-        {
-            return 0;
-        }
-    }
+    char ch;
+    uint8_t key; // index into keys[], KEY_TRIE_NONE for inner nodes
+    uint8_t child;
+    uint8_t sibling;
+};
 
-    return 1;
-}
+static struct key_trie_node key_trie[TB_KEY_TRIE_NODES];
+static int key_trie_size;
 
-static int parse_mouse_event(struct tb_event* event, const char* buf, int len)
+static int key_trie_insert(const char* seq, int key)
 {
-    if ((len >= 6) && starts_with(buf, "\033[M"))
-    {
-        // X10 mouse encoding, the simplest one
-        // \033 [ M Cb Cx Cy
-        int b = buf[3] - 32;
-
-        switch (b & 3)
-        {
-            case 0:
-                if ((b & 64) != 0)
-                {
-                    event->key = TB_KEY_MOUSE_WHEEL_UP;
-                }
-                else
-                {
-                    event->key = TB_KEY_MOUSE_LEFT;
-                }
-
-                break;
-
-            case 1:
-                if ((b & 64) != 0)
-                {
-                    event->key = TB_KEY_MOUSE_WHEEL_DOWN;
-                }
-                else
-                {
-                    event->key = TB_KEY_MOUSE_MIDDLE;
-                }
-
-                break;
-
-            case 2:
-                event->key = TB_KEY_MOUSE_RIGHT;
-                break;
-
-            case 3:
-                event->key = TB_KEY_MOUSE_RELEASE;
-                break;
+    int node = 0;
 
-            default:
-                return -6;
-        }
-
-        event->type = TB_EVENT_MOUSE; // TB_EVENT_KEY by default
+    for (; *seq; seq++)
+    {
+        int child = key_trie[node].child;
 
-        if ((b & 32) != 0)
+        while (child != 0 && key_trie[child].ch != *seq)
         {
-            event->mod |= TB_MOD_MOTION;
+            child = key_trie[child].sibling;
         }
 
-        // the coord is 1,1 for upper left
-        event->x = (uint8_t)buf[4] - 1 - 32;
-        event->y = (uint8_t)buf[5] - 1 - 32;
-        return 6;
-    }
-    else if (starts_with(buf, "\033[<") || starts_with(buf, "\033["))
-    {
-        // xterm 1006 extended mode or urxvt 1015 extended mode
-        // xterm: \033 [ < Cb ; Cx ; Cy (M or m)
-        // urxvt: \033 [ Cb ; Cx ; Cy M
-        int i, mi = -1, starti = -1;
-        int isM, isU, s1 = -1, s2 = -1;
-        int n1 = 0, n2 = 0, n3 = 0;
-
-        for (i = 0; i < len; i++)
+        if (child == 0)
         {
-            // We search the first (s1) and the last (s2) ';'
-            if (buf[i] == ';')
-            {
-                if (s1 == -1)
-                {
-                    s1 = i;
-                }
-
-                s2 = i;
-            }
-
-            // We search for the first 'm' or 'M'
-            if ((buf[i] == 'm' || buf[i] == 'M') && mi == -1)
+            if (key_trie_size >= TB_KEY_TRIE_NODES)
             {
-                mi = i;
-                break;
+                LOG_E("key trie is full, increase TB_KEY_TRIE_NODES");
+                return -1;
             }
-        }
-
-        if (mi == -1)
-        {
-            return 0;
-        }
-
-        // whether it's a capital M or not
-        isM = (buf[mi] == 'M');
-
-        if (buf[2] == '<')
-        {
-            isU = 0;
-            starti = 3;
-        }
-        else
-        {
-            isU = 1;
-            starti = 2;
-        }
-
-        if (s1 == -1 || s2 == -1 || s1 == s2)
-        {
-            return 0;
-        }
 
-        n1 = strtoul(&buf[starti], NULL, 10);
-        n2 = strtoul(&buf[s1 + 1], NULL, 10);
-        n3 = strtoul(&buf[s2 + 1], NULL, 10);
-
-        if (isU)
-        {
-            n1 -= 32;
+            child = key_trie_size++;
+            key_trie[child].ch = *seq;
+            key_trie[child].key = KEY_TRIE_NONE;
+            key_trie[child].child = 0;
+            key_trie[child].sibling = key_trie[node].child;
+            key_trie[node].child = child;
         }
 
-        switch (n1 & 3)
-        {
-            case 0:
-                if ((n1 & 64) != 0)
-                {
-                    event->key = TB_KEY_MOUSE_WHEEL_UP;
-                }
-                else
-                {
-                    event->key = TB_KEY_MOUSE_LEFT;
-                }
+        node = child;
+    }
 
-                break;
+    // the first entry wins for duplicated sequences, as the linear scan did
+    if (key_trie[node].key == KEY_TRIE_NONE)
+    {
+        key_trie[node].key = key;
+    }
 
-            case 1:
-                if ((n1 & 64) != 0)
-                {
-                    event->key = TB_KEY_MOUSE_WHEEL_DOWN;
-                }
-                else
-                {
-                    event->key = TB_KEY_MOUSE_MIDDLE;
-                }
+    return 0;
+}
 
-                break;
+static void key_trie_build(const char** table)
+{
+    int i;
 
-            case 2:
-                event->key = TB_KEY_MOUSE_RIGHT;
-                break;
+    rt_memset(&key_trie[0], 0, sizeof(key_trie[0]));
+    key_trie[0].key = KEY_TRIE_NONE;
+    key_trie_size = 1;
 
-            case 3:
-                event->key = TB_KEY_MOUSE_RELEASE;
-                break;
+    for (i = 0; table[i]; i++)
+    {
+        key_trie_insert(table[i], i);
+    }
+}
 
-            default:
-                return mi + 1;
-        }
+// follow 'ch' from 'node', returns the child node or 0 if there is none
+static int key_trie_step(int node, char ch)
+{
+    int child = key_trie[node].child;
 
-        if (!isM)
-        {
-            // on xterm mouse release is signaled by lowercase m
-            event->key = TB_KEY_MOUSE_RELEASE;
-        }
+    while (child != 0 && key_trie[child].ch != ch)
+    {
+        child = key_trie[child].sibling;
+    }
 
-        event->type = TB_EVENT_MOUSE; // TB_EVENT_KEY by default
+    return child;
+}
 
-        if ((n1 & 32) != 0)
-        {
-            event->mod |= TB_MOD_MOTION;
-        }
+/*
+ * The tables are shared by all contexts and read-only once built. The first
+ * caller claims the build; contexts started at the same time wait until
+ * 'keys' is published, which happens last and with release semantics.
+ */
+static int keys_claimed;
 
-        event->x = (uint8_t)n2 - 1;
-        event->y = (uint8_t)n3 - 1;
-        return mi + 1;
-    }
+#if defined(__GNUC__) || defined(__clang__)
+#define KEYS_LOAD_ACQUIRE()     __atomic_load_n(&keys, __ATOMIC_ACQUIRE)
+#define KEYS_STORE_RELEASE(v)   __atomic_store_n(&keys, (v), __ATOMIC_RELEASE)
+#define KEYS_CLAIM()            (__atomic_exchange_n(&keys_claimed, 1, __ATOMIC_ACQ_REL) == 0)
+#else
+/* single core MCUs: locking the scheduler makes the claim atomic */
+#define KEYS_LOAD_ACQUIRE()     (*(const char** volatile*)&keys)
+#define KEYS_STORE_RELEASE(v)   (*(const char** volatile*)&keys = (v))
+static rt_bool_t KEYS_CLAIM(void)
+{
+    rt_bool_t claimed;
 
-    return 0;
+    rt_enter_critical();
+    claimed = !keys_claimed;
+    keys_claimed = 1;
+    rt_exit_critical();
+    return claimed;
 }
+#endif
 
-// convert escape sequence to event, and return consumed bytes on success (failure == 0)
-static int parse_escape_seq(struct tb_event* event, const char* buf, int len)
+static int init_term(void)
 {
-    int mouse_parsed = parse_mouse_event(event, buf, len);
-
-    if (mouse_parsed != 0)
+    if (KEYS_LOAD_ACQUIRE() != RT_NULL)
     {
-        return mouse_parsed;
+        return 0;
     }
 
-    // it's pretty simple here, find 'starts_with' match and return success, else return failure
-    int i;
-
-    for (i = 0; keys[i]; i++)
+    if (!KEYS_CLAIM())
     {
-        if (starts_with(buf, keys[i]))
+        while (KEYS_LOAD_ACQUIRE() == RT_NULL)
         {
-            event->ch = 0;
-            event->key = 0xFFFF - i;
-            return strlen(keys[i]);
+            rt_thread_mdelay(1);
         }
+        return 0;
     }
 
-    return 0;
+    /* PuTTY supports sterm by default, which can let you to use mouse */
+    funcs = xterm_funcs;
+    key_trie_build(xterm_keys);
+    KEYS_STORE_RELEASE(xterm_keys);
+    return 0;
 }
 
-static rt_bool_t extract_event(struct tb_event* event, struct ringbuffer* inbuf,
-    int inputmode)
-{
-    char buf[BUFFER_SIZE_MAX + 1];
-    int nbytes = ringbuffer_data_size(inbuf);
-
-    if (nbytes > BUFFER_SIZE_MAX)
-    {
-        nbytes = BUFFER_SIZE_MAX;
-    }
-
-    if (nbytes == 0)
-    {
-        return RT_FALSE;
-    }
-
-    ringbuffer_read(inbuf, buf, nbytes);
-    buf[nbytes] = '\0';
-
-    if (buf[0] == '\033')
-    {
-        int n = parse_escape_seq(event, buf, nbytes);
-
-        if (n != 0)
-        {
-            rt_bool_t success = RT_TRUE;
-
-            if (n < 0)
-            {
-                success = RT_FALSE;
-                n = -n;
-            }
-
-            ringbuffer_pop(inbuf, 0, n);
-            return success;
-        }
-        else
-        {
-            // it's not escape sequence, then it's ALT or ESC, check inputmode
-            if (inputmode & TB_INPUT_ESC)
-            {
-                // if we're in escape mode, fill ESC event, pop buffer, return success
-                event->ch = 0;
-                event->key = TB_KEY_ESC;
-                event->mod = 0;
-                ringbuffer_pop(inbuf, 0, 1);
-                return RT_TRUE;
-            }
-            else if (inputmode & TB_INPUT_ALT)
-            {
-                // if we're in alt mode, set ALT modifier to event and redo parsing
-                event->mod = TB_MOD_ALT;
-                ringbuffer_pop(inbuf, 0, 1);
-                return extract_event(event, inbuf, inputmode);
-            }
-        }
-    }
-
-    //  if we're here, this is not an escape sequence and not an alt sequence
-    //  so, it's a FUNCTIONAL KEY or a UNICODE character
-
-    // first of all check if it's a functional key*/
-    if ((unsigned char)buf[0] <= TB_KEY_SPACE ||
-        (unsigned char)buf[0] == TB_KEY_BACKSPACE2)
-    {
-        // fill event, pop buffer, return success
-        event->ch = 0;
-        event->key = (uint16_t)buf[0];
-        ringbuffer_pop(inbuf, 0, 1);
-        return RT_TRUE;
-    }
+/*---------------------context---------------------------*/
+/*
+ * Everything termbox keeps about a terminal is in a struct tb_context, so
+ * one process can drive several terminals, each from a thread of its own.
+ * The tb_*() functions work on a default context on stdin and stdout, the
+ * tb_ctx_*() ones on a context tb_ctx_init() set up on any descriptors.
+ * Only the key table is shared; it is read-only once built.
+ */
+#ifndef TB_INPUT_BUFFER_SIZE
+#define TB_INPUT_BUFFER_SIZE RT_SERIAL_RB_BUFSZ
+#endif
 
-    // feh... we got utf8 here
+#ifndef TB_OUTPUT_BUFFER_SIZE
+#define TB_OUTPUT_BUFFER_SIZE 512
+#endif
 
-    // check if there is all bytes
-    if (nbytes >= utf8_char_length(buf[0]))
-    {
-        // everything ok, fill event, pop buffer, return success
-        utf8_char_to_unicode(&event->ch, buf);
-        event->key = 0;
-        ringbuffer_pop(inbuf, 0, utf8_char_length(buf[0]));
-        return RT_TRUE;
-    }
+#ifndef TB_INPUT_STAMPS
+#define TB_INPUT_STAMPS 16 // power of 2
+#endif
 
-    return RT_FALSE;
-}
+#ifndef TB_LATENCY_SAMPLES
+#define TB_LATENCY_SAMPLES 32
+#endif
 
+#ifndef TB_EVENT_QUEUE_SIZE
+#define TB_EVENT_QUEUE_SIZE 32
+#endif
 
-/*---------------------termbox---------------------------*/
-#define TERMBOX_WAIT_FOREVER    RT_TICK_MAX/2 - 1
+#ifndef TB_COLOR_CACHE_SIZE
+#define TB_COLOR_CACHE_SIZE 64 // entries, a power of two
+#endif
 
 #ifndef TB_NO_MEMDEV
 struct cellbuf
@@ -829,900 +809,5344 @@ struct cellbuf
 #define CELL(buf, x, y) (buf)->cells[(y) * (buf)->width + (x)]
 #endif
 
-#define IS_CURSOR_HIDDEN(cx, cy) (cx == -1 || cy == -1)
-#define LAST_COORD_INIT -1
-
-#ifndef TB_INPUT_BUFFER_SIZE
-#define TB_INPUT_BUFFER_SIZE RT_SERIAL_RB_BUFSZ
-#endif
-
-#ifndef TB_OUTPUT_BUFFER_SIZE
-#define TB_OUTPUT_BUFFER_SIZE 512
-#endif
-
-#ifndef TB_NO_MEMDEV
-static struct cellbuf back_buffer;
-static struct cellbuf front_buffer;
-#endif
-static unsigned char write_buffer_data[TB_OUTPUT_BUFFER_SIZE];
-static struct memstream write_buffer;
-
-static int termw = -1;
-static int termh = -1;
-
-static int inputmode = TB_INPUT_ESC;
-static int outputmode = TB_OUTPUT_NORMAL;
+#define PARSE_PARAMS_MAX 8
 
-static struct ringbuffer inbuf;
+struct input_parser
+{
+    int state;
+    size_t scan;
+    uint8_t mod; // TB_MOD_ALT left by an ESC in alt mode
+    int node; // key trie node, 0 once the sequence left the key table
+    char prefix; // CSI private marker, e.g. '<' of SGR mouse reports
+    int nparams;
+    uint32_t params[PARSE_PARAMS_MAX];
+    int sub; // index of the ':' separated sub-parameter
+    uint32_t event_type; // kitty event type, sub-parameter of the modifiers
+    uint32_t ch; // UTF-8 character being assembled
+    uint32_t utf8; // UTF-8 decoder state
+    rt_bool_t string_skipped; // part of the string left the ring already
+
+    struct tb_event lookahead; // extracted by coalesce_motion() but not merged
+    rt_bool_t has_lookahead;
+};
 
-static int lastx = LAST_COORD_INIT;
-static int lasty = LAST_COORD_INIT;
-static int cursor_x = -1;
-static int cursor_y = -1;
+struct input_stamp
+{
+    size_t end; // ring head after the read
+    uint32_t time;
+};
 
-static uint32_t background = TB_DEFAULT;
-static uint32_t foreground = TB_DEFAULT;
+struct latency_window
+{
+    uint32_t samples[TB_LATENCY_SAMPLES];
+    uint32_t count;
+};
 
-static void write_cursor(int x, int y);
-static void write_sgr(uint32_t fg, uint32_t bg);
+struct tb_context
+{
+    int in_fd;
+    int out_fd;
+    int resize_fd; // SIGWINCH self-pipe, -1 if there is none
 
 #ifndef TB_NO_MEMDEV
-static void cellbuf_init(struct cellbuf* buf, int width, int height);
-static void cellbuf_resize(struct cellbuf* buf, int width, int height);
-static void cellbuf_clear(struct cellbuf* buf);
-static void cellbuf_free(struct cellbuf* buf);
+    struct cellbuf back_buffer;
+    struct cellbuf front_buffer;
+#endif
+    unsigned char write_buffer_data[TB_OUTPUT_BUFFER_SIZE];
+    struct memstream write_buffer;
+    struct ringbuffer inbuf;
+
+    int termw;
+    int termh;
+
+    int inputmode;
+    rt_bool_t csiu_pushed; // ENTER_CSIU_SEQ pushed a kitty keyboard mode
+    int eventmask;
+    int outputmode;
+    int rgbcells; // TB_OUTPUT_RGB
+
+    int lastx;
+    int lasty;
+    uint32_t lastfg;
+    uint32_t lastbg;
+    uint32_t lastfgcol; // as sent to the terminal
+    uint32_t lastbgcol;
+    int cursor_x;
+    int cursor_y;
+
+    uint32_t background;
+    uint32_t foreground;
+
+    // resize, may happen in a different thread
+    volatile int buffer_size_change_request;
+    volatile uint32_t resize_size; // last size reported, RESIZE_PACK()
+    rt_tick_t resize_probe_tick;
+    rt_bool_t resize_cpr; // no TIOCGWINSZ, probe with cursor position reports
+    int resize_cpr_pending; // probes sent but not answered yet
+    rt_tick_t resize_cpr_tick; // when the last one was sent
+
+    // input
+    struct input_parser parser;
+    char* paste_buf;
+    size_t paste_len;
+    size_t paste_capa;
+    rt_bool_t paste_delivered;
+    int esc_gap_avg8; // average gap between bytes of a sequence, in 1/8 ms
+    rt_tick_t input_tick; // when input was last fed to the parser
+    rt_bool_t input_fed; // the application reads the input, see tb_process_input()
+    rt_bool_t replaying; // tb_replay() feeds the parser
+    rt_bool_t input_failed; // a read failed while coalescing, see read_input()
+
+    // latency
+    struct input_stamp input_stamps[TB_INPUT_STAMPS];
+    uint32_t input_stamp_count;
+    struct latency_window latency[TB_LATENCY_STAGES];
+    rt_bool_t latency_pending; // an event was returned since the last frame
+    uint32_t latency_input; // read time of that event
+    uint32_t latency_delivered; // when it was returned
+
+    volatile int record_fd;
+    uint32_t record_time;
+    rt_mutex_t record_lock; // record_fd is written by the reading thread, closed by any
+
+#ifdef TB_USING_INPUT_THREAD
+    struct tb_event event_queue[TB_EVENT_QUEUE_SIZE];
+    size_t queue_head;
+    size_t queue_tail;
+    rt_sem_t queue_ready;
+    rt_sem_t queue_space;
+    rt_sem_t input_thread_exit;
+    rt_sem_t paste_released; // the application is done with the paste buffer
+    rt_bool_t paste_out;
+    volatile int input_thread_quit;
+    rt_bool_t resize_cpr_due; // a probe for the application thread to send
 #endif
 
-static void update_size(void);
-static void update_term_size(void);
-static void send_attr(uint32_t fg, uint32_t bg);
-static void send_char(int x, int y, uint32_t c);
-static void send_clear(void);
-static int wait_fill_event(struct tb_event* event, int timeout);
+    uint32_t color_cache_key[TB_COLOR_CACHE_SIZE]; // mode << 24 | rgb, 0 is empty
+    uint8_t color_cache_value[TB_COLOR_CACHE_SIZE];
+};
 
-// may happen in a different thread
-static volatile int buffer_size_change_request;
+/*---------------------resize---------------------------*/
+/*
+ * Resize detection. With TB_USING_SIGWINCH (POSIX hosts) the signal handler
+ * only writes to a self-pipe which the event loop of the default context
+ * polls along with stdin. Otherwise, and for the terminals of other
+ * contexts, the size is probed every TB_RESIZE_PROBE_INTERVAL milliseconds
+ * while waiting for input: with TIOCGWINSZ where the console supports it,
+ * else with a cursor position report after moving the cursor to the far
+ * bottom right corner, which is what a serial console can offer.
+ */
+#ifdef TB_USING_SIGWINCH
+#include <signal.h>
+#endif
 
-int tb_init(void)
-{
-    init_term();
+#ifndef TB_RESIZE_PROBE_INTERVAL
+#define TB_RESIZE_PROBE_INTERVAL 500 // 0 disables probing
+#endif
 
-    memstream_init(&write_buffer, STDOUT_FILENO, write_buffer_data,
-        sizeof(write_buffer_data));
-    memstream_puts(&write_buffer, funcs[T_ENTER_CA]);
-    memstream_puts(&write_buffer, funcs[T_ENTER_KEYPAD]);
-    memstream_puts(&write_buffer, funcs[T_HIDE_CURSOR]);
-    send_clear();
+// give up on cursor position reports the terminal never answers
+#define RESIZE_CPR_RETRIES 3
+// milliseconds an answer may take on top of the ESC timeout; a report
+// coming later is not told apart from a modified F3 key any more
+#define RESIZE_CPR_WAIT 100
+#define RESIZE_CPR_PROBE "\0337\033[999;999H\033[6n\0338"
 
-    update_term_size();
+#define RESIZE_PACK(w, h) (((uint32_t)(w) << 16) | ((uint32_t)(h) & 0xFFFF))
+#define RESIZE_W(size) ((int)((size) >> 16))
+#define RESIZE_H(size) ((int)((size) & 0xFFFF))
 
-#ifndef TB_NO_MEMDEV
-    cellbuf_init(&back_buffer, termw, termh);
-    cellbuf_init(&front_buffer, termw, termh);
-    cellbuf_clear(&back_buffer);
-    cellbuf_clear(&front_buffer);
+#ifdef TB_USING_SIGWINCH
+static int winch_fds[2] = {-1, -1};
 #endif
 
-    init_ringbuffer(&inbuf, TB_INPUT_BUFFER_SIZE);
+static int query_term_size(struct tb_context* ctx, int* w, int* h)
+{
+    struct winsize sz;
+    rt_memset(&sz, 0, sizeof(sz));
+
+    if (ioctl(ctx->out_fd, TIOCGWINSZ, &sz) < 0 || sz.ws_col == 0 || sz.ws_row == 0)
+    {
+        return -1;
+    }
 
+    *w = sz.ws_col;
+    *h = sz.ws_row;
     return 0;
 }
 
-void tb_shutdown(void)
+// a detected size is only worth a TB_EVENT_RESIZE if it differs from the
+// size reported last
+static rt_bool_t resize_changed(struct tb_context* ctx, int w, int h)
 {
-    if (termw == -1)
+    if (w <= 0 || h <= 0 || RESIZE_PACK(w, h) == ctx->resize_size)
     {
-        return;
+        return RT_FALSE;
     }
 
-    memstream_puts(&write_buffer, funcs[T_SHOW_CURSOR]);
-    memstream_puts(&write_buffer, funcs[T_SGR0]);
-    memstream_puts(&write_buffer, funcs[T_CLEAR_SCREEN]);
-    memstream_puts(&write_buffer, funcs[T_EXIT_CA]);
-    memstream_puts(&write_buffer, funcs[T_EXIT_KEYPAD]);
-    memstream_puts(&write_buffer, funcs[T_EXIT_MOUSE]);
-    memstream_flush(&write_buffer);
-
-#ifndef TB_NO_MEMDEV
-    cellbuf_free(&back_buffer);
-    cellbuf_free(&front_buffer);
-#endif
-    free_ringbuffer(&inbuf);
-    termw = termh = -1;
+    ctx->resize_size = RESIZE_PACK(w, h);
+    ctx->buffer_size_change_request = 1;
+    return RT_TRUE;
 }
 
-void tb_present(void)
+// the probe moves the cursor and puts it back, so it goes through the
+// output buffer between frames and never into the middle of one
+static void resize_send_probe(struct tb_context* ctx)
 {
-#ifndef TB_NO_MEMDEV
-    int x, y, w, i;
-    struct tb_cell* back, *front;
-
-    // invalidate cursor position
-    lastx = LAST_COORD_INIT;
-    lasty = LAST_COORD_INIT;
-
-    if (buffer_size_change_request)
-    {
-        update_size();
-        buffer_size_change_request = 0;
-    }
+    memstream_puts(&ctx->write_buffer, RESIZE_CPR_PROBE);
+    memstream_flush(&ctx->write_buffer);
+}
 
-    for (y = 0; y < front_buffer.height; ++y)
-    {
-        for (x = 0; x < front_buffer.width;)
-        {
-            back = &CELL(&back_buffer, x, y);
-            front = &CELL(&front_buffer, x, y);
-            w = wcwidth(back->ch);
-            if (w < 1)
-            {
-                w = 1;
-            }
+static int esc_timeout(struct tb_context* ctx);
 
-            if (memcmp(back, front, sizeof(struct tb_cell)) == 0)
-            {
-                x += w;
-                continue;
-            }
+// is a cursor position report still expected?
+static rt_bool_t resize_cpr_awaited(struct tb_context* ctx)
+{
+    rt_tick_t wait = rt_tick_from_millisecond(esc_timeout(ctx) + RESIZE_CPR_WAIT);
 
-            rt_memcpy(front, back, sizeof(struct tb_cell));
-            send_attr(back->fg, back->bg);
+    return ctx->resize_cpr_pending > 0 && rt_tick_get() - ctx->resize_cpr_tick < wait;
+}
 
-            if (w > 1 && x >= front_buffer.width - (w - 1))
-            {
-                // Not enough room for wide ch, so send spaces
-                for (i = x; i < front_buffer.width; ++i)
-                {
-                    send_char(i, y, ' ');
-                }
-            }
-            else
-            {
-                send_char(x, y, back->ch);
+// the answer to \033[999;999H\033[6n is the bottom right corner. A modified
+// F3 key, \033[1;5R, looks the same but is always on row 1.
+static rt_bool_t resize_cpr_plausible(uint32_t row, uint32_t col)
+{
+    return row > 1 && row <= 999 && col > 0 && col <= 999;
+}
 
-                for (i = 1; i < w; ++i)
-                {
-                    front = &CELL(&front_buffer, x + i, y);
-                    front->ch = 0;
-                    front->fg = back->fg;
-                    front->bg = back->bg;
-                }
-            }
+static rt_bool_t resize_probe(struct tb_context* ctx, struct tb_event* event)
+{
+    int w, h;
 
-            x += w;
+    if (!ctx->resize_cpr)
+    {
+        if (query_term_size(ctx, &w, &h) != 0 || !resize_changed(ctx, w, h))
+        {
+            return RT_FALSE;
         }
+
+        rt_memset(event, 0, sizeof(struct tb_event));
+        event->type = TB_EVENT_RESIZE;
+        event->w = w;
+        event->h = h;
+        return RT_TRUE;
     }
 
-    if (!IS_CURSOR_HIDDEN(cursor_x, cursor_y))
+    // the answer arrives as input, see csi_final()
+    if (ctx->resize_cpr_pending < RESIZE_CPR_RETRIES)
     {
-        write_cursor(cursor_x, cursor_y);
+        ctx->resize_cpr_pending++;
+        ctx->resize_cpr_tick = rt_tick_get();
+#ifdef TB_USING_INPUT_THREAD
+        ctx->resize_cpr_due = RT_TRUE; // the output is not ours, see input_thread_entry()
+#else
+        resize_send_probe(ctx);
+#endif
     }
-#endif /* TB_NO_MEMDEV */
-    memstream_flush(&write_buffer);
+
+    return RT_FALSE;
 }
 
-void tb_set_cursor(int cx, int cy)
+// milliseconds until the next probe is due, -1 if there is none
+static int resize_wait(struct tb_context* ctx)
 {
-    if (IS_CURSOR_HIDDEN(cursor_x, cursor_y) && !IS_CURSOR_HIDDEN(cx, cy))
-    {
-        memstream_puts(&write_buffer, funcs[T_SHOW_CURSOR]);
-    }
+#if TB_RESIZE_PROBE_INTERVAL == 0
+    return -1;
+#else
+    rt_tick_t elapsed = rt_tick_get() - ctx->resize_probe_tick;
+    rt_tick_t interval = rt_tick_from_millisecond(TB_RESIZE_PROBE_INTERVAL);
 
-    if (!IS_CURSOR_HIDDEN(cursor_x, cursor_y) && IS_CURSOR_HIDDEN(cx, cy))
+    if (ctx->resize_fd >= 0 ||
+        (ctx->resize_cpr && ctx->resize_cpr_pending >= RESIZE_CPR_RETRIES))
     {
-        memstream_puts(&write_buffer, funcs[T_HIDE_CURSOR]);
+        return -1;
     }
 
-    cursor_x = cx;
-    cursor_y = cy;
-
-    if (!IS_CURSOR_HIDDEN(cursor_x, cursor_y))
+    if (elapsed >= interval)
     {
-        write_cursor(cursor_x, cursor_y);
+        return 0;
     }
+
+    return (interval - elapsed) * 1000 / RT_TICK_PER_SECOND + 1;
+#endif
 }
 
-void tb_put_cell(int x, int y, const struct tb_cell* cell)
+// probe the size if it is time to, throttled to TB_RESIZE_PROBE_INTERVAL
+static rt_bool_t resize_poll(struct tb_context* ctx, struct tb_event* event)
 {
-#ifndef TB_NO_MEMDEV
-    if ((unsigned)x >= (unsigned)back_buffer.width)
-    {
-        return;
-    }
-
-    if ((unsigned)y >= (unsigned)back_buffer.height)
+    if (resize_wait(ctx) != 0)
     {
-        return;
+        return RT_FALSE;
     }
 
-    CELL(&back_buffer, x, y) = *cell;
-#else
-    send_attr(cell->fg, cell->bg);
-    send_char(x, y, cell->ch);
-#endif
+    ctx->resize_probe_tick = rt_tick_get();
+    return resize_probe(ctx, event);
 }
 
-void tb_change_cell(int x, int y, uint32_t ch, uint32_t fg, uint32_t bg)
+#ifdef TB_USING_SIGWINCH
+static void sigwinch_handler(int signo)
 {
-    struct tb_cell c = {ch, fg, bg};
-    tb_put_cell(x, y, &c);
+    const char c = 0;
+
+    (void)signo;
+    write(winch_fds[1], &c, 1);
 }
 
-#ifndef TB_NO_MEMDEV
-void tb_blit(int x, int y, int w, int h, const struct tb_cell* cells)
+// empty the self-pipe and ask for the new size if a signal came in
+static rt_bool_t resize_signaled(struct tb_context* ctx, struct tb_event* event)
 {
-    if (x + w < 0 || x >= back_buffer.width)
-    {
-        return;
-    }
+    char buf[8];
 
-    if (y + h < 0 || y >= back_buffer.height)
+    if (ctx->resize_fd < 0 || read(ctx->resize_fd, buf, sizeof(buf)) <= 0)
     {
-        return;
+        return RT_FALSE;
     }
 
-    int xo = 0, yo = 0, ww = w, hh = h;
+    while (read(ctx->resize_fd, buf, sizeof(buf)) > 0);
+    return resize_probe(ctx, event);
+}
+#endif /* TB_USING_SIGWINCH */
 
-    if (x < 0)
-    {
-        xo = -x;
-        ww -= xo;
-        x = 0;
-    }
+// SIGWINCH is about the controlling terminal, only 'ctx' hears about it
+static int resize_trap_init(struct tb_context* ctx)
+{
+#ifdef TB_USING_SIGWINCH
+    struct sigaction sa;
 
-    if (y < 0)
+    if (pipe(winch_fds) < 0)
     {
-        yo = -y;
-        hh -= yo;
-        y = 0;
+        winch_fds[0] = winch_fds[1] = -1;
+        return -1;
     }
 
-    if (ww > back_buffer.width - x)
-    {
-        ww = back_buffer.width - x;
-    }
+    fcntl(winch_fds[0], F_SETFL, fcntl(winch_fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(winch_fds[1], F_SETFL, fcntl(winch_fds[1], F_GETFL) | O_NONBLOCK);
 
-    if (hh > back_buffer.height - y)
-    {
-        hh = back_buffer.height - y;
-    }
+    rt_memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigwinch_handler;
+    sigaction(SIGWINCH, &sa, RT_NULL);
+    ctx->resize_fd = winch_fds[0];
+#else
+    (void)ctx;
+#endif
+    return 0;
+}
 
-    int sy;
-    struct tb_cell* dst = &CELL(&back_buffer, x, y);
-    const struct tb_cell* src = cells + yo * w + xo;
-    size_t size = sizeof(struct tb_cell) * ww;
+static void resize_trap_free(struct tb_context* ctx)
+{
+#ifdef TB_USING_SIGWINCH
+    struct sigaction sa;
 
-    for (sy = 0; sy < hh; ++sy)
+    rt_memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigaction(SIGWINCH, &sa, RT_NULL);
+
+    close(winch_fds[0]);
+    close(winch_fds[1]);
+    winch_fds[0] = winch_fds[1] = -1;
+#endif
+    ctx->resize_fd = -1;
+}
+
+// start detecting from the size termbox was initialized with
+static void resize_start(struct tb_context* ctx, int w, int h)
+{
+    int qw, qh;
+
+    ctx->resize_size = RESIZE_PACK(w, h);
+    ctx->buffer_size_change_request = 0;
+    ctx->resize_cpr = query_term_size(ctx, &qw, &qh) != 0;
+    ctx->resize_cpr_pending = 0;
+
+    // without TIOCGWINSZ the size is a guess, probe for it right away
+    ctx->resize_probe_tick = rt_tick_get();
+    if (ctx->resize_cpr)
     {
-        rt_memcpy(dst, src, size);
-        dst += back_buffer.width;
-        src += w;
+        ctx->resize_probe_tick -= rt_tick_from_millisecond(TB_RESIZE_PROBE_INTERVAL);
     }
 }
 
-struct tb_cell* tb_cell_buffer(void)
+/*---------------------input---------------------------*/
+#define BUFFER_SIZE_MAX 16
+
+/*
+ * Streaming input parser. Bytes are examined in place in the input ring;
+ * 'scan' counts the bytes of the current sequence examined so far and they
+ * are only popped once the sequence is complete, so an incomplete sequence
+ * can still be taken apart again (lone ESC, ALT prefix) when the escape
+ * timeout expires. All state survives between reads, sequences may be split
+ * anywhere and have no length limit other than the ring size. OSC, DCS, APC,
+ * PM and SOS strings (terminal replies) are skipped. Their introducers are
+ * also ALT+], ALT+P, ALT+_, ALT+^ and ALT+X, so a string is only started
+ * while a reply is expected or when more bytes follow before the escape
+ * timeout, and one that is still unterminated at the escape timeout is taken
+ * apart again as keys.
+ */
+enum
 {
-    return back_buffer.cells;
-}
-#endif /* TB_NO_MEMDEV */
+    PARSE_GROUND,
+    PARSE_UTF8,
+    PARSE_ESC,
+    PARSE_CSI,
+    PARSE_SS3,
+    PARSE_X10, // \033[M followed by three raw bytes
+    PARSE_STRING,
+    PARSE_STRING_ESC,
+    PARSE_PASTE,
+};
 
-int tb_poll_event(struct tb_event* event)
+#define PARSE_PARAM_LIMIT 0x10FFFF
+
+// returns true while the parser is inside a sequence which more input could
+// complete, i.e. when it is worth to wait for the escape timeout
+static rt_bool_t parser_pending(struct tb_context* ctx)
 {
-    return wait_fill_event(event, TERMBOX_WAIT_FOREVER);
+    return ctx->parser.state != PARSE_GROUND && ctx->parser.state != PARSE_PASTE;
 }
 
-int tb_peek_event(struct tb_event* event, int timeout)
+static void parser_reset(struct tb_context* ctx)
 {
-    return wait_fill_event(event, timeout);
+    rt_memset(&ctx->parser, 0, sizeof(ctx->parser));
 }
 
-int tb_width(void)
+static rt_bool_t parser_emit(struct tb_context* ctx, struct tb_event* event)
 {
-    return termw;
+    ringbuffer_pop(&ctx->inbuf, 0, ctx->parser.scan);
+    ctx->parser.scan = 0;
+    ctx->parser.state = PARSE_GROUND;
+    event->mod |= ctx->parser.mod;
+    ctx->parser.mod = 0;
+    return RT_TRUE;
 }
 
-int tb_height(void)
+static void parser_drop(struct tb_context* ctx)
 {
-    return termh;
+    ringbuffer_pop(&ctx->inbuf, 0, ctx->parser.scan);
+    ctx->parser.scan = 0;
+    ctx->parser.state = PARSE_GROUND;
 }
 
-void tb_clear(void)
-{
-    if (buffer_size_change_request)
-    {
-        update_size();
-        buffer_size_change_request = 0;
-    }
+/*
+ * Bracketed paste: everything between PASTE_BEGIN and PASTE_END is copied
+ * verbatim into a growable buffer and delivered as one TB_EVENT_PASTE, so
+ * ESC bytes inside the pasted text are never parsed as keys. The buffer is
+ * reused once the application has seen the event.
+ */
+#define PASTE_BEGIN "\033[200~"
+#define PASTE_END   "\033[201~"
+#define PASTE_MARK_LEN (sizeof(PASTE_BEGIN) - 1)
+#define PASTE_CHUNK 64
 
-#ifndef TB_NO_MEMDEV
-    cellbuf_clear(&back_buffer);
+#ifndef TB_PASTE_BUFFER_MAX
+#define TB_PASTE_BUFFER_MAX (64 * 1024)
 #endif
-}
 
-int tb_select_input_mode(int mode)
+static void paste_append(struct tb_context* ctx, const char* data, size_t len)
 {
-    if (mode)
+    if (ctx->paste_delivered)
     {
-        if ((mode & (TB_INPUT_ESC | TB_INPUT_ALT)) == 0)
-        {
-            mode |= TB_INPUT_ESC;
-        }
-
-        // technically termbox can handle that, but let's be nice
-        // and show here what mode is actually used
-        if ((mode & (TB_INPUT_ESC | TB_INPUT_ALT)) == (TB_INPUT_ESC | TB_INPUT_ALT))
-        {
-            mode &= ~TB_INPUT_ALT;
-        }
+        ctx->paste_len = 0;
+        ctx->paste_delivered = RT_FALSE;
+    }
 
-        inputmode = mode;
+    if (ctx->paste_len + len > ctx->paste_capa)
+    {
+        size_t capa = ctx->paste_capa ? ctx->paste_capa : 256;
+        char* buf;
 
-        if (mode & TB_INPUT_MOUSE)
+        while (capa < ctx->paste_len + len)
         {
-            memstream_puts(&write_buffer, funcs[T_ENTER_MOUSE]);
-            memstream_flush(&write_buffer);
+            capa *= 2;
         }
-        else
+
+        buf = (char*)rt_realloc(ctx->paste_buf, capa);
+        if (buf == RT_NULL)
         {
-            memstream_puts(&write_buffer, funcs[T_EXIT_MOUSE]);
-            memstream_flush(&write_buffer);
+            LOG_E("paste buffer realloc error!");
+            return;
         }
+
+        ctx->paste_buf = buf;
+        ctx->paste_capa = capa;
     }
 
-    return inputmode;
+    rt_memcpy(ctx->paste_buf + ctx->paste_len, data, len);
+    ctx->paste_len += len;
 }
 
-int tb_select_output_mode(int mode)
+static void paste_free(struct tb_context* ctx)
 {
-    if (mode)
-    {
-        outputmode = mode;
-    }
-
-    return outputmode;
+    rt_free(ctx->paste_buf);
+    ctx->paste_buf = RT_NULL;
+    ctx->paste_len = ctx->paste_capa = 0;
+    ctx->paste_delivered = RT_FALSE;
 }
 
-void tb_set_clear_attributes(uint32_t fg, uint32_t bg)
+static rt_bool_t extract_paste(struct tb_context* ctx, struct tb_event* event)
+{
+    char buf[PASTE_CHUNK];
+    size_t nbytes;
+
+    while ((nbytes = ringbuffer_data_size(&ctx->inbuf)) > 0)
+    {
+        const char* esc;
+        size_t plain;
+
+        if (!ctx->paste_delivered && ctx->paste_len >= TB_PASTE_BUFFER_MAX)
+        {
+            break; /* deliver what we have, the paste goes on */
+        }
+
+        if (nbytes > sizeof(buf))
+        {
+            nbytes = sizeof(buf);
+        }
+
+        ringbuffer_read(&ctx->inbuf, buf, nbytes);
+        esc = memchr(buf, '\033', nbytes);
+        plain = esc ? (size_t)(esc - buf) : nbytes;
+
+        if (plain == 0)
+        {
+            plain = (nbytes < PASTE_MARK_LEN) ? nbytes : PASTE_MARK_LEN;
+
+            if (memcmp(buf, PASTE_END, plain) != 0)
+            {
+                plain = 1; /* an ESC that is part of the text */
+            }
+            else if (plain < PASTE_MARK_LEN)
+            {
+                return RT_FALSE; /* wait for the rest of the end marker */
+            }
+            else
+            {
+                ringbuffer_pop(&ctx->inbuf, 0, PASTE_MARK_LEN);
+                ctx->parser.state = PARSE_GROUND;
+                break;
+            }
+        }
+
+        paste_append(ctx, buf, plain);
+        ringbuffer_pop(&ctx->inbuf, 0, plain);
+    }
+
+    if (ctx->parser.state == PARSE_PASTE &&
+        (ctx->paste_delivered || ctx->paste_len < TB_PASTE_BUFFER_MAX))
+    {
+        return RT_FALSE;
+    }
+
+    if (ctx->paste_delivered)
+    {
+        ctx->paste_len = 0; /* empty paste */
+    }
+
+    event->type = TB_EVENT_PASTE;
+    event->data = ctx->paste_buf;
+    event->len = ctx->paste_len;
+    ctx->paste_delivered = RT_TRUE;
+    return RT_TRUE;
+}
+
+static void mouse_event(struct tb_event* event, int b, int x, int y, rt_bool_t release)
+{
+    switch (b & 3)
+    {
+        case 0:
+            event->key = (b & 64) ? TB_KEY_MOUSE_WHEEL_UP : TB_KEY_MOUSE_LEFT;
+            break;
+
+        case 1:
+            event->key = (b & 64) ? TB_KEY_MOUSE_WHEEL_DOWN : TB_KEY_MOUSE_MIDDLE;
+            break;
+
+        case 2:
+            event->key = TB_KEY_MOUSE_RIGHT;
+            break;
+
+        case 3:
+            event->key = TB_KEY_MOUSE_RELEASE;
+            break;
+    }
+
+    if (release)
+    {
+        // on xterm mouse release is signaled by lowercase m
+        event->key = TB_KEY_MOUSE_RELEASE;
+    }
+
+    event->type = TB_EVENT_MOUSE; // TB_EVENT_KEY by default
+
+    if ((b & 32) != 0)
+    {
+        event->mod |= TB_MOD_MOTION;
+    }
+
+    // the coord is 1,1 for upper left
+    event->x = x - 1;
+    event->y = y - 1;
+}
+
+static void csi_param(struct tb_context* ctx, char c)
+{
+    if (c == ';')
+    {
+        if (ctx->parser.nparams < PARSE_PARAMS_MAX)
+        {
+            ctx->parser.nparams++;
+        }
+
+        ctx->parser.sub = 0;
+        return;
+    }
+
+    if (ctx->parser.nparams == 0)
+    {
+        ctx->parser.nparams = 1;
+    }
+
+    if (c == ':')
+    {
+        ctx->parser.sub++;
+        return;
+    }
+
+    if (ctx->parser.sub == 0 && ctx->parser.nparams <= PARSE_PARAMS_MAX)
+    {
+        uint32_t* p = &ctx->parser.params[ctx->parser.nparams - 1];
+
+        *p = *p * 10 + (c - '0');
+
+        if (*p > PARSE_PARAM_LIMIT)
+        {
+            *p = PARSE_PARAM_LIMIT;
+        }
+    }
+    else if (ctx->parser.sub == 1 && ctx->parser.nparams == 2)
+    {
+        // CSI code ; modifiers : event-type u
+        ctx->parser.event_type = ctx->parser.event_type * 10 + (c - '0');
+    }
+}
+
+// xterm style modifier parameter: 1 + bitmask of shift, alt, ctrl, super,
+// hyper, meta
+static uint8_t csi_mods(uint32_t param)
+{
+    uint8_t mod = 0;
+
+    if (param < 2)
+    {
+        return 0;
+    }
+
+    param -= 1;
+
+    if (param & 1)
+    {
+        mod |= TB_MOD_SHIFT;
+    }
+
+    if (param & (2 | 32))
+    {
+        mod |= TB_MOD_ALT;
+    }
+
+    if (param & 4)
+    {
+        mod |= TB_MOD_CTRL;
+    }
+
+    if (param & (8 | 16))
+    {
+        mod |= TB_MOD_SUPER;
+    }
+
+    return mod;
+}
+
+// CSI 1 ; modifiers <final>
+static const char csi_letter_finals[] = "ABCDHFPQRS";
+static const uint16_t csi_letter_keys[] =
+{
+    TB_KEY_ARROW_UP, TB_KEY_ARROW_DOWN, TB_KEY_ARROW_RIGHT, TB_KEY_ARROW_LEFT,
+    TB_KEY_HOME, TB_KEY_END, TB_KEY_F1, TB_KEY_F2, TB_KEY_F3, TB_KEY_F4,
+};
+
+// CSI number ; modifiers ~, indexed by number
+static const uint16_t csi_tilde_keys[] =
+{
+    0, TB_KEY_HOME, TB_KEY_INSERT, TB_KEY_DELETE, TB_KEY_END, TB_KEY_PGUP,
+    TB_KEY_PGDN, TB_KEY_HOME, TB_KEY_END, 0, 0, TB_KEY_F1, TB_KEY_F2, TB_KEY_F3,
+    TB_KEY_F4, TB_KEY_F5, 0, TB_KEY_F6, TB_KEY_F7, TB_KEY_F8, TB_KEY_F9,
+    TB_KEY_F10, 0, TB_KEY_F11, TB_KEY_F12,
+};
+
+// fill 'event' from a unicode key code of a CSI u or modifyOtherKeys report
+static rt_bool_t csi_codepoint(struct tb_event* event, uint32_t code)
+{
+    switch (code)
+    {
+        case 8:
+        case 9:
+        case 13:
+        case 27:
+        case 127:
+            event->key = code;
+            return RT_TRUE;
+
+        default:
+            break;
+    }
+
+    if (code >= 0xE000 && code <= 0xF8FF)
+    {
+        return RT_FALSE; /* kitty functional key without a termbox equivalent */
+    }
+
+    // keep the classic control codes for Ctrl+letter and Ctrl+Space
+    if ((event->mod & TB_MOD_CTRL) &&
+        (code == ' ' || (code >= '@' && code <= '_') || (code >= 'a' && code <= 'z')))
+    {
+        event->key = code & 0x1F;
+        return RT_TRUE;
+    }
+
+    if (code == ' ')
+    {
+        event->key = TB_KEY_SPACE;
+        return RT_TRUE;
+    }
+
+    event->ch = code;
+    return RT_TRUE;
+}
+
+// keys with modifiers: CSI 1;mod A..S, CSI n;mod ~, CSI code;mod u (kitty)
+// and CSI 27;mod;code ~ (modifyOtherKeys)
+static rt_bool_t csi_key(struct tb_context* ctx, struct tb_event* event, char c)
+{
+    uint32_t* p = ctx->parser.params;
+    const char* f;
+
+    if (ctx->parser.prefix != 0)
+    {
+        return RT_FALSE;
+    }
+
+    event->ch = 0;
+    event->key = 0;
+    event->mod |= csi_mods(p[1]);
+
+    if (ctx->parser.event_type == 2)
+    {
+        event->mod |= TB_MOD_REPEAT;
+    }
+    else if (ctx->parser.event_type == 3)
+    {
+        event->mod |= TB_MOD_RELEASE;
+    }
+
+    if (c == 'u' && ctx->parser.nparams >= 1)
+    {
+        return csi_codepoint(event, p[0]);
+    }
+
+    if (c == '~' && p[0] == 27 && ctx->parser.nparams >= 3)
+    {
+        return csi_codepoint(event, p[2]);
+    }
+
+    if (c == '~' && p[0] < sizeof(csi_tilde_keys) / sizeof(csi_tilde_keys[0]) &&
+        csi_tilde_keys[p[0]] != 0)
+    {
+        event->key = csi_tilde_keys[p[0]];
+        return RT_TRUE;
+    }
+
+    f = strchr(csi_letter_finals, c);
+    if (c != '\0' && f != RT_NULL && p[0] <= 1)
+    {
+        event->key = csi_letter_keys[f - csi_letter_finals];
+        return RT_TRUE;
+    }
+
+    return RT_FALSE;
+}
+
+// handle the final byte of a CSI sequence which is not in the key table
+static rt_bool_t csi_final(struct tb_context* ctx, struct tb_event* event, char c)
+{
+    uint32_t* p = ctx->parser.params;
+
+    if ((c == 'M' || c == 'm') && ctx->parser.prefix == '<' && ctx->parser.nparams >= 3)
+    {
+        // xterm 1006 extended mode: \033 [ < Cb ; Cx ; Cy (M or m)
+        mouse_event(event, p[0], p[1], p[2], c == 'm');
+        return parser_emit(ctx, event);
+    }
+
+    if (c == 'M' && ctx->parser.prefix == 0 && ctx->parser.nparams >= 3)
+    {
+        // urxvt 1015 extended mode: \033 [ Cb ; Cx ; Cy M
+        mouse_event(event, p[0] - 32, p[1], p[2], RT_FALSE);
+        return parser_emit(ctx, event);
+    }
+
+    if (c == 'M' && ctx->parser.prefix == 0 && ctx->parser.nparams == 0)
+    {
+        // X10 mouse encoding, the simplest one: \033 [ M Cb Cx Cy
+        ctx->parser.state = PARSE_X10;
+        return RT_FALSE;
+    }
+
+    if (c == '~' && ctx->parser.prefix == 0 && ctx->parser.nparams == 1 && p[0] == 200)
+    {
+        parser_drop(ctx);
+        ctx->parser.state = PARSE_PASTE;
+        ctx->paste_len = 0;
+        ctx->paste_delivered = RT_FALSE;
+        return extract_paste(ctx, event);
+    }
+
+    if (c == 'R' && ctx->parser.prefix == 0 && ctx->parser.nparams == 2 &&
+        resize_cpr_awaited(ctx) && resize_cpr_plausible(p[0], p[1]))
+    {
+        // cursor position report answering resize_probe(): \033 [ row ; col R
+        ctx->resize_cpr_pending = 0;
+        event->type = TB_EVENT_RESIZE;
+        event->w = p[1];
+        event->h = p[0];
+        return parser_emit(ctx, event);
+    }
+
+    if (csi_key(ctx, event, c) == RT_TRUE)
+    {
+        return parser_emit(ctx, event);
+    }
+
+    // unknown sequence, swallow it
+    event->mod = 0;
+    parser_drop(ctx);
+    return RT_FALSE;
+}
+
+// the sequence after an ESC turned out not to be a known one (or will never
+// be completed): ESC is either TB_KEY_ESC or the ALT modifier, and the bytes
+// after it are parsed again from scratch
+static rt_bool_t esc_fallback(struct tb_context* ctx, struct tb_event* event)
+{
+    ctx->parser.scan = 1;
+
+    if (ctx->inputmode & TB_INPUT_ESC)
+    {
+        event->ch = 0;
+        event->key = TB_KEY_ESC;
+        event->mod = 0;
+        ctx->parser.mod = 0;
+        return parser_emit(ctx, event);
+    }
+
+    parser_drop(ctx);
+    ctx->parser.mod = TB_MOD_ALT;
+    return RT_FALSE;
+}
+
+// convert input to an event, returns RT_FALSE if no complete event could be
+// extracted from the buffered bytes. With 'flush' set, an incomplete
+// sequence at the end of the input is resolved instead of waited for.
+static rt_bool_t extract_event(struct tb_context* ctx, struct tb_event* event, rt_bool_t flush)
+{
+    unsigned char c;
+    rt_bool_t more;
+    int key;
+
+    while (1)
+    {
+        if (ctx->parser.state == PARSE_PASTE)
+        {
+            return extract_paste(ctx, event);
+        }
+
+        if (ctx->parser.scan >= ringbuffer_data_size(&ctx->inbuf))
+        {
+            // out of input, give up on the sequence if asked to or if it can
+            // never complete because it fills the whole ring
+            if (ctx->parser.state == PARSE_GROUND ||
+                (!flush && ringbuffer_free_space(&ctx->inbuf) > 0))
+            {
+                return RT_FALSE;
+            }
+
+            switch (ctx->parser.state)
+            {
+                case PARSE_UTF8:
+                    event->ch = 0xFFFD;
+                    event->key = 0;
+                    return parser_emit(ctx, event);
+
+                case PARSE_STRING:
+                case PARSE_STRING_ESC:
+                    if (!flush)
+                    {
+                        // too long for a key, keep skipping it as a reply
+                        ringbuffer_pop(&ctx->inbuf, 0, ctx->parser.scan);
+                        ctx->parser.scan = 0;
+                        ctx->parser.string_skipped = RT_TRUE;
+                        return RT_FALSE;
+                    }
+
+                    if (ctx->parser.string_skipped)
+                    {
+                        parser_drop(ctx);
+                        return RT_FALSE;
+                    }
+
+                    if (esc_fallback(ctx, event) == RT_TRUE)
+                    {
+                        return RT_TRUE;
+                    }
+
+                    continue;
+
+                default:
+                    if (esc_fallback(ctx, event) == RT_TRUE)
+                    {
+                        return RT_TRUE;
+                    }
+
+                    continue;
+            }
+        }
+
+        c = (unsigned char)ringbuffer_at(&ctx->inbuf, ctx->parser.scan++);
+        more = RT_FALSE;
+
+        if (ctx->parser.state == PARSE_ESC || ctx->parser.state == PARSE_CSI ||
+            ctx->parser.state == PARSE_SS3)
+        {
+            // the key table has the last word, so any layout of sequences works
+            ctx->parser.node = ctx->parser.node ? key_trie_step(ctx->parser.node, c) : 0;
+            key = ctx->parser.node ? key_trie[ctx->parser.node].key : KEY_TRIE_NONE;
+
+            if (key != KEY_TRIE_NONE)
+            {
+                event->ch = 0;
+                event->key = 0xFFFF - key;
+                return parser_emit(ctx, event);
+            }
+
+            more = ctx->parser.node && key_trie[ctx->parser.node].child;
+        }
+
+        switch (ctx->parser.state)
+        {
+            case PARSE_GROUND:
+                if (c == '\033')
+                {
+                    ctx->parser.state = PARSE_ESC;
+                    ctx->parser.node = key_trie_step(0, c);
+                    ctx->parser.prefix = 0;
+                    ctx->parser.nparams = 0;
+                    ctx->parser.sub = 0;
+                    ctx->parser.event_type = 0;
+                    rt_memset(ctx->parser.params, 0, sizeof(ctx->parser.params));
+                }
+                else if (c <= TB_KEY_SPACE || c == TB_KEY_BACKSPACE2)
+                {
+                    // it's a FUNCTIONAL KEY
+                    event->ch = 0;
+                    event->key = c;
+                    return parser_emit(ctx, event);
+                }
+                else if (c < 0x80)
+                {
+                    event->ch = c;
+                    event->key = 0;
+                    return parser_emit(ctx, event);
+                }
+                else
+                {
+                    ctx->parser.utf8 = utf8_step(UTF8_ACCEPT, &ctx->parser.ch, c);
+                    if (ctx->parser.utf8 == UTF8_REJECT)
+                    {
+                        // not a lead byte
+                        event->ch = 0xFFFD;
+                        event->key = 0;
+                        return parser_emit(ctx, event);
+                    }
+
+                    ctx->parser.state = PARSE_UTF8;
+                }
+
+                break;
+
+            case PARSE_UTF8:
+                ctx->parser.utf8 = utf8_step(ctx->parser.utf8, &ctx->parser.ch, c);
+
+                if (ctx->parser.utf8 == UTF8_REJECT)
+                {
+                    // invalid or truncated character, parse this byte on its own
+                    ctx->parser.scan--;
+                    event->ch = 0xFFFD;
+                    event->key = 0;
+                    return parser_emit(ctx, event);
+                }
+
+                if (ctx->parser.utf8 == UTF8_ACCEPT)
+                {
+                    event->ch = ctx->parser.ch;
+                    event->key = 0;
+                    return parser_emit(ctx, event);
+                }
+
+                break;
+
+            case PARSE_ESC:
+                if (c == '[')
+                {
+                    ctx->parser.state = PARSE_CSI;
+                }
+                else if (c == 'O' || more)
+                {
+                    // SS3, or another prefix from the key table
+                    ctx->parser.state = PARSE_SS3;
+                }
+                else if ((c == ']' || c == 'P' || c == '_' || c == '^' || c == 'X') &&
+                    (resize_cpr_awaited(ctx) ||
+                    ctx->parser.scan < ringbuffer_data_size(&ctx->inbuf)))
+                {
+                    ctx->parser.state = PARSE_STRING;
+                    ctx->parser.string_skipped = RT_FALSE;
+                }
+                else if ((c == ']' || c == 'P' || c == '_' || c == '^' || c == 'X') && !flush)
+                {
+                    // a string or an ALT key, nothing came after it yet
+                    ctx->parser.scan--;
+                    return RT_FALSE;
+                }
+                else if (esc_fallback(ctx, event) == RT_TRUE)
+                {
+                    return RT_TRUE;
+                }
+
+                break;
+
+            case PARSE_CSI:
+                if ((c >= '0' && c <= '9') || c == ';' || c == ':')
+                {
+                    csi_param(ctx, c);
+                }
+                else if (c >= 0x3C && c <= 0x3F && ctx->parser.scan == 3)
+                {
+                    ctx->parser.prefix = c;
+                }
+                else if (more)
+                {
+                    break;
+                }
+                else if (c >= 0x40 && c <= 0x7E)
+                {
+                    if (csi_final(ctx, event, c) == RT_TRUE)
+                    {
+                        return RT_TRUE;
+                    }
+                }
+                else if (c < 0x20 || c > 0x7E)
+                {
+                    // not a CSI sequence after all
+                    if (esc_fallback(ctx, event) == RT_TRUE)
+                    {
+                        return RT_TRUE;
+                    }
+                }
+
+                break;
+
+            case PARSE_SS3:
+                if (!more && esc_fallback(ctx, event) == RT_TRUE)
+                {
+                    // not a key from the table: ALT+O (or ESC, O) and this key
+                    return RT_TRUE;
+                }
+
+                break;
+
+            case PARSE_X10:
+                ctx->parser.params[ctx->parser.nparams++] = c;
+
+                if (ctx->parser.nparams == 3)
+                {
+                    mouse_event(event, ctx->parser.params[0] - 32, ctx->parser.params[1] - 32,
+                        ctx->parser.params[2] - 32, RT_FALSE);
+                    return parser_emit(ctx, event);
+                }
+
+                break;
+
+            case PARSE_STRING:
+            case PARSE_STRING_ESC:
+                // terminated by BEL or ST (\033\\)
+                if (c == 0x07 || (ctx->parser.state == PARSE_STRING_ESC && c == '\\'))
+                {
+                    parser_drop(ctx);
+                }
+                else
+                {
+                    ctx->parser.state = (c == '\033') ? PARSE_STRING_ESC : PARSE_STRING;
+                }
+
+                break;
+        }
+    }
+}
+
+/*---------------------latency---------------------------*/
+/*
+ * Input-to-photon latency. Every read is stamped with the ring position it
+ * filled up to, so an event can be given the time at which its last byte
+ * arrived. The oldest event handed to the application since the previous
+ * frame is then followed through to the flush of the next tb_present().
+ */
+#ifndef TB_CLOCK_US
+#define TB_CLOCK_US() ((uint32_t)rt_tick_get() * (1000000UL / RT_TICK_PER_SECOND))
+#endif
+
+static void input_stamp_add(struct tb_context* ctx, size_t end)
+{
+    struct input_stamp* st = &ctx->input_stamps[ctx->input_stamp_count % TB_INPUT_STAMPS];
+
+    st->end = end;
+    st->time = TB_CLOCK_US();
+    ctx->input_stamp_count++;
+}
+
+// time of the read which delivered the byte at ring position 'pos'
+static uint32_t input_stamp_lookup(struct tb_context* ctx, size_t pos)
+{
+    struct input_stamp* st;
+    uint32_t n = ctx->input_stamp_count < TB_INPUT_STAMPS ?
+        ctx->input_stamp_count : TB_INPUT_STAMPS;
+
+    // oldest first; a byte older than every stamp gets the oldest one
+    for (; n > 0; n--)
+    {
+        st = &ctx->input_stamps[(ctx->input_stamp_count - n) % TB_INPUT_STAMPS];
+        if (st->end - pos - 1 < ((size_t)-1) / 2)
+        {
+            return st->time;
+        }
+    }
+
+    return TB_CLOCK_US();
+}
+
+static void latency_add(struct tb_context* ctx, int stage, uint32_t us)
+{
+    struct latency_window* win = &ctx->latency[stage];
+
+    win->samples[win->count % TB_LATENCY_SAMPLES] = us;
+    win->count++;
+}
+
+static void latency_events_delivered(struct tb_context* ctx, const struct tb_event* events, int n)
+{
+    uint32_t now;
+    int i;
+
+    if (n <= 0 || ctx->latency_pending)
+    {
+        return;
+    }
+
+    now = TB_CLOCK_US();
+    ctx->latency_input = events[0].time;
+
+    // 'time' is not monotonic across events (a flushed ESC may be older
+    // than the key after it), keep the oldest
+    for (i = 1; i < n; i++)
+    {
+        if ((int32_t)(events[i].time - ctx->latency_input) < 0)
+        {
+            ctx->latency_input = events[i].time;
+        }
+    }
+
+    ctx->latency_delivered = now;
+    ctx->latency_pending = RT_TRUE;
+}
+
+static void latency_frame(struct tb_context* ctx, uint32_t begin, uint32_t diffed, uint32_t flushed)
+{
+    latency_add(ctx, TB_LATENCY_DIFF, diffed - begin);
+    latency_add(ctx, TB_LATENCY_WRITE, flushed - diffed);
+
+    if (ctx->latency_pending)
+    {
+        latency_add(ctx, TB_LATENCY_GATHER, ctx->latency_delivered - ctx->latency_input);
+        latency_add(ctx, TB_LATENCY_APP, begin - ctx->latency_delivered);
+        latency_add(ctx, TB_LATENCY_TOTAL, flushed - ctx->latency_input);
+        ctx->latency_pending = RT_FALSE;
+    }
+}
+
+/*---------------------termbox---------------------------*/
+#define TERMBOX_WAIT_FOREVER    RT_TICK_MAX/2 - 1
+
+#define IS_CURSOR_HIDDEN(cx, cy) (cx == -1 || cy == -1)
+#define LAST_COORD_INIT -1
+#define LAST_ATTR_INIT 0xFFFFFFFF
+#define TB_ATTR_MASK (TB_BOLD | TB_UNDERLINE | TB_REVERSE)
+#define COLOR_DEFAULT 0x01000000 // SGR 39 or 49
+#define COLOR_KEEP    0x02000000 // not sent
+
+static void write_cursor(struct tb_context* ctx, int x, int y);
+static void write_sgr(struct tb_context* ctx, uint32_t fg, uint32_t bg);
+
+#ifndef TB_NO_MEMDEV
+static int cellbuf_init(struct cellbuf* buf, int width, int height);
+static int cellbuf_resize(struct tb_context* ctx, struct cellbuf* buf, int width, int height);
+static void cellbuf_clear(struct tb_context* ctx, struct cellbuf* buf);
+static void cellbuf_free(struct cellbuf* buf);
+#endif
+
+static void update_size(struct tb_context* ctx);
+static void update_term_size(struct tb_context* ctx);
+static void send_attr(struct tb_context* ctx, uint32_t fg, uint32_t bg);
+static void send_char(struct tb_context* ctx, int x, int y, uint32_t c);
+#ifndef TB_NO_MEMDEV
+static int send_run(struct tb_context* ctx, int x, int y);
+#endif
+static void send_clear(struct tb_context* ctx);
+static uint8_t color_quantize(struct tb_context* ctx, uint32_t color, int mode);
+static int wait_fill_event(struct tb_context* ctx, struct tb_event* event, int timeout);
+static void record_input(struct tb_context* ctx, const char* data, size_t len);
+#ifdef TB_USING_INPUT_THREAD
+static int input_thread_start(struct tb_context* ctx);
+static void input_thread_stop(struct tb_context* ctx);
+static int event_queue_wait(struct tb_context* ctx, struct tb_event* event, int timeout);
+static int event_queue_drain(struct tb_context* ctx, struct tb_event* events, int max);
+#else
+static int drain_events(struct tb_context* ctx, struct tb_event* events, int max);
+#endif
+
+// the state of a context before it is started; selected modes and the
+// clear attributes are kept from here on
+static void ctx_preset(struct tb_context* ctx)
+{
+    rt_memset(ctx, 0, sizeof(struct tb_context));
+    ctx->in_fd = -1;
+    ctx->out_fd = -1;
+    ctx->resize_fd = -1;
+    ctx->termw = -1;
+    ctx->termh = -1;
+    ctx->inputmode = TB_INPUT_ESC;
+    ctx->eventmask = TB_SUBSCRIBE_ALL;
+    ctx->outputmode = TB_OUTPUT_NORMAL;
+    ctx->lastx = LAST_COORD_INIT;
+    ctx->lasty = LAST_COORD_INIT;
+    ctx->lastfg = LAST_ATTR_INIT;
+    ctx->lastbg = LAST_ATTR_INIT;
+    ctx->lastfgcol = COLOR_DEFAULT;
+    ctx->lastbgcol = COLOR_DEFAULT;
+    ctx->cursor_x = -1;
+    ctx->cursor_y = -1;
+    ctx->background = TB_DEFAULT;
+    ctx->foreground = TB_DEFAULT;
+    ctx->esc_gap_avg8 = 2 * 8;
+    ctx->record_fd = -1;
+}
+
+// returns -1 if the context could not be set up, undo it with ctx_stop()
+static int ctx_start(struct tb_context* ctx, int in_fd, int out_fd)
+{
+    init_term();
+
+    ctx->in_fd = in_fd;
+    ctx->out_fd = out_fd;
+    memstream_init(&ctx->write_buffer, out_fd, ctx->write_buffer_data,
+        sizeof(ctx->write_buffer_data));
+    memstream_puts(&ctx->write_buffer, funcs[T_ENTER_CA]);
+    memstream_puts(&ctx->write_buffer, funcs[T_ENTER_KEYPAD]);
+    memstream_puts(&ctx->write_buffer, funcs[T_HIDE_CURSOR]);
+    ctx->lastfg = LAST_ATTR_INIT;
+    ctx->lastbg = LAST_ATTR_INIT;
+    send_clear(ctx);
+
+    update_term_size(ctx);
+    resize_start(ctx, ctx->termw, ctx->termh);
+
+#ifndef TB_NO_MEMDEV
+    if (cellbuf_init(&ctx->back_buffer, ctx->termw, ctx->termh) != 0 ||
+        cellbuf_init(&ctx->front_buffer, ctx->termw, ctx->termh) != 0)
+    {
+        return -1;
+    }
+    cellbuf_clear(ctx, &ctx->back_buffer);
+    cellbuf_clear(ctx, &ctx->front_buffer);
+#endif
+
+    if (init_ringbuffer(&ctx->inbuf, TB_INPUT_BUFFER_SIZE) != 0)
+    {
+        return -1;
+    }
+    ctx->record_lock = rt_mutex_create("tb_rec", RT_IPC_FLAG_PRIO);
+    if (ctx->record_lock == RT_NULL)
+    {
+        LOG_E("cannot create record lock!");
+        return -1;
+    }
+
+    parser_reset(ctx);
+    ctx->input_fed = RT_FALSE;
+    ctx->input_failed = RT_FALSE;
+    ctx->input_stamp_count = 0;
+    tb_ctx_reset_latency_stats(ctx);
+
+#ifdef TB_USING_INPUT_THREAD
+    if (input_thread_start(ctx) != 0)
+    {
+        LOG_E("cannot start input thread!");
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+// returns RT_FALSE if the context was not started
+static rt_bool_t ctx_stop(struct tb_context* ctx)
+{
+    if (ctx->termw == -1)
+    {
+        return RT_FALSE;
+    }
+
+    memstream_puts(&ctx->write_buffer, funcs[T_SHOW_CURSOR]);
+    memstream_puts(&ctx->write_buffer, funcs[T_SGR0]);
+    memstream_puts(&ctx->write_buffer, funcs[T_CLEAR_SCREEN]);
+    memstream_puts(&ctx->write_buffer, funcs[T_EXIT_CA]);
+    memstream_puts(&ctx->write_buffer, funcs[T_EXIT_KEYPAD]);
+    memstream_puts(&ctx->write_buffer, funcs[T_EXIT_MOUSE]);
+    memstream_puts(&ctx->write_buffer, funcs[T_EXIT_PASTE]);
+    if (ctx->csiu_pushed)
+    {
+        memstream_puts(&ctx->write_buffer, funcs[T_EXIT_CSIU]);
+        ctx->csiu_pushed = RT_FALSE;
+    }
+    memstream_flush(&ctx->write_buffer);
+
+#ifdef TB_USING_INPUT_THREAD
+    input_thread_stop(ctx);
+#endif
+
+#ifndef TB_NO_MEMDEV
+    cellbuf_free(&ctx->back_buffer);
+    cellbuf_free(&ctx->front_buffer);
+#endif
+    free_ringbuffer(&ctx->inbuf);
+    paste_free(ctx);
+    tb_ctx_record_stop(ctx);
+    if (ctx->record_lock != RT_NULL)
+    {
+        rt_mutex_delete(ctx->record_lock);
+        ctx->record_lock = RT_NULL;
+    }
+    ctx->termw = ctx->termh = -1;
+    return RT_TRUE;
+}
+
+struct tb_context* tb_ctx_init(int in_fd, int out_fd)
+{
+    struct tb_context* ctx = (struct tb_context*)rt_malloc(sizeof(struct tb_context));
+
+    if (ctx == RT_NULL)
+    {
+        LOG_E("context malloc error!");
+        return RT_NULL;
+    }
+
+    ctx_preset(ctx);
+    if (ctx_start(ctx, in_fd, out_fd) != 0)
+    {
+        ctx_stop(ctx);
+        rt_free(ctx);
+        return RT_NULL;
+    }
+
+    return ctx;
+}
+
+void tb_ctx_shutdown(struct tb_context* ctx)
+{
+    if (ctx == RT_NULL)
+    {
+        return;
+    }
+
+    ctx_stop(ctx);
+    rt_free(ctx);
+}
+
+void tb_ctx_present(struct tb_context* ctx)
+{
+    uint32_t begin = TB_CLOCK_US(), diffed;
+#ifndef TB_NO_MEMDEV
+    int x, y, w, i;
+    struct tb_cell* back, *front;
+
+    // invalidate cursor position
+    ctx->lastx = LAST_COORD_INIT;
+    ctx->lasty = LAST_COORD_INIT;
+
+    if (ctx->buffer_size_change_request)
+    {
+        update_size(ctx);
+        ctx->buffer_size_change_request = 0;
+    }
+
+    for (y = 0; y < ctx->front_buffer.height; ++y)
+    {
+        for (x = 0; x < ctx->front_buffer.width;)
+        {
+            back = &CELL(&ctx->back_buffer, x, y);
+            front = &CELL(&ctx->front_buffer, x, y);
+            w = UTF8_PRINTABLE(back->ch) ? 1 : wcwidth(back->ch);
+            if (w < 1)
+            {
+                w = 1;
+            }
+
+            if (memcmp(back, front, sizeof(struct tb_cell)) == 0)
+            {
+                x += w;
+                continue;
+            }
+
+            send_attr(ctx, back->fg, back->bg);
+
+            if (w > 1 && x >= ctx->front_buffer.width - (w - 1))
+            {
+                rt_memcpy(front, back, sizeof(struct tb_cell));
+
+                // Not enough room for wide ch, so send spaces
+                for (i = x; i < ctx->front_buffer.width; ++i)
+                {
+                    send_char(ctx, i, y, ' ');
+                }
+
+                x += w;
+            }
+            else
+            {
+                x = send_run(ctx, x, y);
+            }
+        }
+    }
+
+    if (!IS_CURSOR_HIDDEN(ctx->cursor_x, ctx->cursor_y))
+    {
+        write_cursor(ctx, ctx->cursor_x, ctx->cursor_y);
+    }
+#endif /* TB_NO_MEMDEV */
+    diffed = TB_CLOCK_US();
+    memstream_flush(&ctx->write_buffer);
+    latency_frame(ctx, begin, diffed, TB_CLOCK_US());
+}
+
+void tb_ctx_set_cursor(struct tb_context* ctx, int cx, int cy)
+{
+    if (IS_CURSOR_HIDDEN(ctx->cursor_x, ctx->cursor_y) && !IS_CURSOR_HIDDEN(cx, cy))
+    {
+        memstream_puts(&ctx->write_buffer, funcs[T_SHOW_CURSOR]);
+    }
+
+    if (!IS_CURSOR_HIDDEN(ctx->cursor_x, ctx->cursor_y) && IS_CURSOR_HIDDEN(cx, cy))
+    {
+        memstream_puts(&ctx->write_buffer, funcs[T_HIDE_CURSOR]);
+    }
+
+    ctx->cursor_x = cx;
+    ctx->cursor_y = cy;
+
+    if (!IS_CURSOR_HIDDEN(ctx->cursor_x, ctx->cursor_y))
+    {
+        write_cursor(ctx, ctx->cursor_x, ctx->cursor_y);
+    }
+}
+
+void tb_ctx_put_cell(struct tb_context* ctx, int x, int y, const struct tb_cell* cell)
+{
+#ifndef TB_NO_MEMDEV
+    if ((unsigned)x >= (unsigned)ctx->back_buffer.width)
+    {
+        return;
+    }
+
+    if ((unsigned)y >= (unsigned)ctx->back_buffer.height)
+    {
+        return;
+    }
+
+    CELL(&ctx->back_buffer, x, y) = *cell;
+#else
+    send_attr(ctx, cell->fg, cell->bg);
+    send_char(ctx, x, y, cell->ch);
+#endif
+}
+
+void tb_ctx_change_cell(struct tb_context* ctx, int x, int y, uint32_t ch, uint32_t fg, uint32_t bg)
+{
+    struct tb_cell c = {ch, fg, bg};
+    tb_ctx_put_cell(ctx, x, y, &c);
+}
+
+#ifndef TB_NO_MEMDEV
+void tb_ctx_blit(struct tb_context* ctx, int x, int y, int w, int h, const struct tb_cell* cells)
+{
+    if (x + w < 0 || x >= ctx->back_buffer.width)
+    {
+        return;
+    }
+
+    if (y + h < 0 || y >= ctx->back_buffer.height)
+    {
+        return;
+    }
+
+    int xo = 0, yo = 0, ww = w, hh = h;
+
+    if (x < 0)
+    {
+        xo = -x;
+        ww -= xo;
+        x = 0;
+    }
+
+    if (y < 0)
+    {
+        yo = -y;
+        hh -= yo;
+        y = 0;
+    }
+
+    if (ww > ctx->back_buffer.width - x)
+    {
+        ww = ctx->back_buffer.width - x;
+    }
+
+    if (hh > ctx->back_buffer.height - y)
+    {
+        hh = ctx->back_buffer.height - y;
+    }
+
+    int sy;
+    struct tb_cell* dst = &CELL(&ctx->back_buffer, x, y);
+    const struct tb_cell* src = cells + yo * w + xo;
+    size_t size = sizeof(struct tb_cell) * ww;
+
+    for (sy = 0; sy < hh; ++sy)
+    {
+        rt_memcpy(dst, src, size);
+        dst += ctx->back_buffer.width;
+        src += w;
+    }
+}
+
+struct tb_cell* tb_ctx_cell_buffer(struct tb_context* ctx)
+{
+    return ctx->back_buffer.cells;
+}
+#endif /* TB_NO_MEMDEV */
+
+int tb_ctx_poll_event(struct tb_context* ctx, struct tb_event* event)
+{
+    return tb_ctx_peek_event(ctx, event, TERMBOX_WAIT_FOREVER);
+}
+
+int tb_ctx_peek_event(struct tb_context* ctx, struct tb_event* event, int timeout)
+{
+    int ret;
+
+#ifdef TB_USING_INPUT_THREAD
+    ret = event_queue_wait(ctx, event, timeout);
+#else
+    ret = wait_fill_event(ctx, event, timeout);
+#endif
+    latency_events_delivered(ctx, event, ret > 0 ? 1 : 0);
+    return ret;
+}
+
+int tb_ctx_poll_events(struct tb_context* ctx, struct tb_event* events, int max, int timeout)
+{
+    int n;
+
+    if (max <= 0)
+    {
+        return 0;
+    }
+
+#ifdef TB_USING_INPUT_THREAD
+    n = event_queue_wait(ctx, &events[0], timeout);
+    if (n <= 0)
+    {
+        return n;
+    }
+
+    n = 1 + event_queue_drain(ctx, events + 1, max - 1);
+#else
+    n = wait_fill_event(ctx, &events[0], timeout);
+    if (n <= 0)
+    {
+        return n;
+    }
+
+    n = 1;
+    if (events[0].type != TB_EVENT_PASTE)
+    {
+        n += drain_events(ctx, events + 1, max - 1);
+    }
+#endif
+    latency_events_delivered(ctx, events, n);
+    return n;
+}
+
+int tb_ctx_width(struct tb_context* ctx)
+{
+    return ctx->termw;
+}
+
+int tb_ctx_height(struct tb_context* ctx)
+{
+    return ctx->termh;
+}
+
+void tb_ctx_clear(struct tb_context* ctx)
+{
+    if (ctx->buffer_size_change_request)
+    {
+        update_size(ctx);
+        ctx->buffer_size_change_request = 0;
+    }
+
+#ifndef TB_NO_MEMDEV
+    cellbuf_clear(ctx, &ctx->back_buffer);
+#endif
+}
+
+int tb_ctx_select_input_mode(struct tb_context* ctx, int mode)
+{
+    if (mode)
+    {
+        if ((mode & (TB_INPUT_ESC | TB_INPUT_ALT)) == 0)
+        {
+            mode |= TB_INPUT_ESC;
+        }
+
+        // technically termbox can handle that, but let's be nice
+        // and show here what mode is actually used
+        if ((mode & (TB_INPUT_ESC | TB_INPUT_ALT)) == (TB_INPUT_ESC | TB_INPUT_ALT))
+        {
+            mode &= ~TB_INPUT_ALT;
+        }
+
+        ctx->inputmode = mode;
+
+        if (mode & TB_INPUT_MOUSE)
+        {
+            memstream_puts(&ctx->write_buffer, funcs[T_ENTER_MOUSE]);
+            memstream_flush(&ctx->write_buffer);
+        }
+        else
+        {
+            memstream_puts(&ctx->write_buffer, funcs[T_EXIT_MOUSE]);
+            memstream_flush(&ctx->write_buffer);
+        }
+
+        if (mode & TB_INPUT_PASTE)
+        {
+            memstream_puts(&ctx->write_buffer, funcs[T_ENTER_PASTE]);
+            memstream_flush(&ctx->write_buffer);
+        }
+        else
+        {
+            memstream_puts(&ctx->write_buffer, funcs[T_EXIT_PASTE]);
+            memstream_flush(&ctx->write_buffer);
+        }
+
+        // the kitty keyboard mode is a stack, push and pop it only once
+        if ((mode & TB_INPUT_CSIU) && !ctx->csiu_pushed)
+        {
+            memstream_puts(&ctx->write_buffer, funcs[T_ENTER_CSIU]);
+            memstream_flush(&ctx->write_buffer);
+            ctx->csiu_pushed = RT_TRUE;
+        }
+        else if (!(mode & TB_INPUT_CSIU) && ctx->csiu_pushed)
+        {
+            memstream_puts(&ctx->write_buffer, funcs[T_EXIT_CSIU]);
+            memstream_flush(&ctx->write_buffer);
+            ctx->csiu_pushed = RT_FALSE;
+        }
+    }
+
+    return ctx->inputmode;
+}
+
+int tb_ctx_select_event_mask(struct tb_context* ctx, int mask)
+{
+    if (mask)
+    {
+        ctx->eventmask = mask;
+    }
+
+    return ctx->eventmask;
+}
+
+int tb_ctx_select_output_mode(struct tb_context* ctx, int mode)
+{
+    if (mode)
+    {
+        ctx->rgbcells = (mode & TB_OUTPUT_RGB) != 0;
+        mode &= ~TB_OUTPUT_RGB;
+    }
+
+    if (mode)
+    {
+        ctx->outputmode = mode;
+    }
+
+    // the same cell colours may stand for other colours now
+    ctx->lastfg = LAST_ATTR_INIT;
+    ctx->lastbg = LAST_ATTR_INIT;
+
+    return ctx->outputmode | (ctx->rgbcells ? TB_OUTPUT_RGB : 0);
+}
+
+void tb_ctx_set_clear_attributes(struct tb_context* ctx, uint32_t fg, uint32_t bg)
+{
+    ctx->foreground = fg;
+    ctx->background = bg;
+}
+
+static unsigned convertnum(uint32_t num, char* buf)
+{
+    unsigned i, l = 0;
+    int ch;
+
+    do
+    {
+        buf[l++] = '0' + (num % 10);
+        num /= 10;
+    }
+    while (num);
+
+    for (i = 0; i < l / 2; i++)
+    {
+        ch = buf[i];
+        buf[i] = buf[l - 1 - i];
+        buf[l - 1 - i] = ch;
+    }
+
+    return l;
+}
+
+#define WRITE_LITERAL(X) memstream_write(&ctx->write_buffer, (X), sizeof(X) -1)
+#define WRITE_INT(X) memstream_write(&ctx->write_buffer, buf, convertnum((X), buf))
+
+static void write_cursor(struct tb_context* ctx, int x, int y)
+{
+    char buf[32];
+    WRITE_LITERAL("\033[");
+    WRITE_INT(y + 1);
+    WRITE_LITERAL(";");
+    WRITE_INT(x + 1);
+    WRITE_LITERAL("H");
+}
+
+// one colour of an SGR sequence, for the background when 'bg' is set
+static void write_color(struct tb_context* ctx, uint32_t c, rt_bool_t bg)
+{
+    char buf[32];
+
+    if (c == COLOR_DEFAULT)
+    {
+        if (bg)
+        {
+            WRITE_LITERAL("49");
+        }
+        else
+        {
+            WRITE_LITERAL("39");
+        }
+        return;
+    }
+
+    switch (ctx->outputmode)
+    {
+        case TB_OUTPUT_TRUECOLOR:
+            if (bg)
+            {
+                WRITE_LITERAL("48;2;");
+            }
+            else
+            {
+                WRITE_LITERAL("38;2;");
+            }
+            WRITE_INT(c >> 16 & 0xFF);
+            WRITE_LITERAL(";");
+            WRITE_INT(c >> 8 & 0xFF);
+            WRITE_LITERAL(";");
+            WRITE_INT(c & 0xFF);
+            break;
+
+        case TB_OUTPUT_256:
+        case TB_OUTPUT_216:
+        case TB_OUTPUT_GRAYSCALE:
+            if (bg)
+            {
+                WRITE_LITERAL("48;5;");
+            }
+            else
+            {
+                WRITE_LITERAL("38;5;");
+            }
+            WRITE_INT(c);
+            break;
+
+        case TB_OUTPUT_NORMAL:
+        default:
+            if (bg)
+            {
+                WRITE_LITERAL("4");
+            }
+            else
+            {
+                WRITE_LITERAL("3");
+            }
+            WRITE_INT(c - 1);
+            break;
+    }
+}
+
+// the colours which are not COLOR_KEEP, in a single sequence
+static void write_sgr(struct tb_context* ctx, uint32_t fg, uint32_t bg)
+{
+    if (fg == COLOR_KEEP && bg == COLOR_KEEP)
+    {
+        return;
+    }
+
+    WRITE_LITERAL("\033[");
+
+    if (fg != COLOR_KEEP)
+    {
+        write_color(ctx, fg, RT_FALSE);
+
+        if (bg != COLOR_KEEP)
+        {
+            WRITE_LITERAL(";");
+        }
+    }
+
+    if (bg != COLOR_KEEP)
+    {
+        write_color(ctx, bg, RT_TRUE);
+    }
+
+    WRITE_LITERAL("m");
+}
+
+#ifndef TB_NO_MEMDEV
+static int cellbuf_init(struct cellbuf* buf, int width, int height)
+{
+    buf->cells = (struct tb_cell*)rt_malloc(sizeof(struct tb_cell) * width * height);
+    if(buf->cells == RT_NULL)
+    {
+        LOG_E("cellbuf_init malloc error!");
+        return -1;
+    }
+
+    buf->width = width;
+    buf->height = height;
+    return 0;
+}
+
+// returns -1 and keeps the old cells if there is no memory for the new ones
+static int cellbuf_resize(struct tb_context* ctx, struct cellbuf* buf, int width, int height)
+{
+    if (buf->width == width && buf->height == height)
+    {
+        return 0;
+    }
+
+    if(buf->cells == RT_NULL)
+    {
+        return -1;
+    }
+
+    int oldw = buf->width;
+    int oldh = buf->height;
+    struct tb_cell* oldcells = buf->cells;
+
+    if (cellbuf_init(buf, width, height) != 0)
+    {
+        buf->cells = oldcells;
+        return -1;
+    }
+    cellbuf_clear(ctx, buf);
+
+    int minw = (width < oldw) ? width : oldw;
+    int minh = (height < oldh) ? height : oldh;
+    int i;
+
+    for (i = 0; i < minh; ++i)
+    {
+        struct tb_cell* csrc = oldcells + (i * oldw);
+        struct tb_cell* cdst = buf->cells + (i * width);
+        rt_memcpy(cdst, csrc, sizeof(struct tb_cell) * minw);
+    }
+
+    rt_free(oldcells);
+    return 0;
+}
+
+static void cellbuf_clear(struct tb_context* ctx, struct cellbuf* buf)
+{
+    int i;
+    int ncells = buf->width * buf->height;
+
+    if(buf->cells == RT_NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < ncells; ++i)
+    {
+        buf->cells[i].ch = ' ';
+        buf->cells[i].fg = ctx->foreground;
+        buf->cells[i].bg = ctx->background;
+    }
+}
+
+static void cellbuf_free(struct cellbuf* buf)
+{
+    rt_free(buf->cells);
+    buf->cells = RT_NULL;
+}
+#endif /* TB_NO_MEMDEV */
+
+static void update_term_size(struct tb_context* ctx)
+{
+    if (query_term_size(ctx, &ctx->termw, &ctx->termh) != 0)
+    {
+        /* use default value if we cannot get the window size */
+        ctx->termw = 80;
+        ctx->termh = 24;
+    }
+}
+
+// the colour of 'c' in the output mode, or COLOR_DEFAULT
+static uint32_t color_for_mode(struct tb_context* ctx, uint32_t c, rt_bool_t bg)
+{
+    if (ctx->rgbcells || ctx->outputmode == TB_OUTPUT_TRUECOLOR)
+    {
+        if ((c & 0xFFFFFF) == 0 && !(c & TB_TRUECOLOR_BLACK))
+        {
+            return COLOR_DEFAULT;
+        }
+
+        if (ctx->outputmode == TB_OUTPUT_TRUECOLOR)
+        {
+            return c & 0xFFFFFF;
+        }
+
+        // 24-bit cells, converted for the terminal through the cache
+        c = color_quantize(ctx, c & 0xFFFFFF, ctx->outputmode);
+    }
+
+    switch (ctx->outputmode)
+    {
+        case TB_OUTPUT_256:
+            c &= 0xFF;
+            return c == TB_DEFAULT ? COLOR_DEFAULT : c;
+
+        case TB_OUTPUT_216:
+            c &= 0xFF;
+
+            if (c > 215)
+            {
+                c = bg ? 0 : 7;
+            }
+
+            return c + 0x10;
+
+        case TB_OUTPUT_GRAYSCALE:
+            c &= 0xFF;
+
+            if (c > 23)
+            {
+                c = bg ? 0 : 23;
+            }
+
+            return c + 0xe8;
+
+        case TB_OUTPUT_NORMAL:
+        default:
+            c &= 0x0F;
+            return c == TB_DEFAULT ? COLOR_DEFAULT : c;
+    }
+}
+
+static void send_attr(struct tb_context* ctx, uint32_t fg, uint32_t bg)
+{
+    uint32_t fgcol, bgcol;
+
+    if (fg == ctx->lastfg && bg == ctx->lastbg)
+    {
+        return;
+    }
+
+    fgcol = color_for_mode(ctx, fg, RT_FALSE);
+    bgcol = color_for_mode(ctx, bg, RT_TRUE);
+
+    // attributes can only be turned off all together, and the colours with
+    // them, otherwise only the colours which changed are sent
+    if (ctx->lastfg == LAST_ATTR_INIT || ((fg ^ ctx->lastfg) & TB_ATTR_MASK) ||
+        ((bg ^ ctx->lastbg) & TB_ATTR_MASK))
+    {
+        memstream_puts(&ctx->write_buffer, funcs[T_SGR0]);
+        ctx->lastfgcol = COLOR_DEFAULT;
+        ctx->lastbgcol = COLOR_DEFAULT;
+
+        if (fg & TB_BOLD)
+        {
+            memstream_puts(&ctx->write_buffer, funcs[T_BOLD]);
+        }
+
+        if (bg & TB_BOLD)
+        {
+            memstream_puts(&ctx->write_buffer, funcs[T_BLINK]);
+        }
+
+        if (fg & TB_UNDERLINE)
+        {
+            memstream_puts(&ctx->write_buffer, funcs[T_UNDERLINE]);
+        }
+
+        if ((fg & TB_REVERSE) || (bg & TB_REVERSE))
+        {
+            memstream_puts(&ctx->write_buffer, funcs[T_REVERSE]);
+        }
+    }
+
+    write_sgr(ctx, fgcol != ctx->lastfgcol ? fgcol : COLOR_KEEP,
+        bgcol != ctx->lastbgcol ? bgcol : COLOR_KEEP);
+
+    ctx->lastfg = fg;
+    ctx->lastbg = bg;
+    ctx->lastfgcol = fgcol;
+    ctx->lastbgcol = bgcol;
+}
+
+// the bytes of one cell, straight into the output buffer
+rt_inline void write_char(struct tb_context* ctx, uint32_t c)
+{
+    unsigned char* out = memstream_reserve(&ctx->write_buffer, 4);
+
+    if (c < 0x80)
+    {
+        *out = c ? (unsigned char)c : ' '; // replace 0 with whitespace
+        ctx->write_buffer.pos++;
+    }
+    else
+    {
+        ctx->write_buffer.pos += utf8_encode(out, c);
+    }
+}
+
+static void send_char(struct tb_context* ctx, int x, int y, uint32_t c)
+{
+    if (x - 1 != ctx->lastx || y != ctx->lasty)
+    {
+        write_cursor(ctx, x, y);
+    }
+
+    ctx->lastx = x;
+    ctx->lasty = y;
+
+    write_char(ctx, c);
+}
+
+#ifndef TB_NO_MEMDEV
+// send the changed cell at x, y and the changed cells of the same style
+// following it, with the cursor positioned once. The front buffer takes
+// them over. Returns the column after the run.
+static int send_run(struct tb_context* ctx, int x, int y)
+{
+    struct tb_cell* back = &CELL(&ctx->back_buffer, x, y);
+    struct tb_cell* front = &CELL(&ctx->front_buffer, x, y);
+    uint32_t fg = back->fg, bg = back->bg, ch;
+    int w, i;
+
+    if (x - 1 != ctx->lastx || y != ctx->lasty)
+    {
+        write_cursor(ctx, x, y);
+    }
+    ctx->lasty = y;
+
+    for (;;)
+    {
+        ch = back->ch;
+        if (UTF8_PRINTABLE(ch))
+        {
+            // the common case: one byte, one column
+            if (ctx->write_buffer.pos == ctx->write_buffer.capa)
+            {
+                memstream_reserve(&ctx->write_buffer, 1);
+            }
+            ctx->write_buffer.data[ctx->write_buffer.pos++] = (unsigned char)ch;
+            *front = *back;
+            ctx->lastx = x++;
+        }
+        else
+        {
+            w = wcwidth(ch);
+            if (w < 1)
+            {
+                w = 1;
+            }
+
+            write_char(ctx, ch);
+            *front = *back;
+            ctx->lastx = x;
+
+            for (i = 1; i < w; ++i)
+            {
+                front[i].ch = 0;
+                front[i].fg = fg;
+                front[i].bg = bg;
+            }
+
+            x += w;
+            if (w > 1)
+            {
+                // where the terminal puts the cursor after a wide character
+                // is not certain, the next one is positioned again
+                return x;
+            }
+        }
+
+        back++;
+        front++;
+
+        if (x >= ctx->front_buffer.width || back->fg != fg || back->bg != bg ||
+            memcmp(back, front, sizeof(struct tb_cell)) == 0)
+        {
+            return x;
+        }
+
+        // a wide character without room is left to the caller
+        if (!UTF8_PRINTABLE(back->ch) && wcwidth(back->ch) > 1 &&
+            x >= ctx->front_buffer.width - 1)
+        {
+            return x;
+        }
+    }
+}
+#endif
+
+static void send_clear(struct tb_context* ctx)
+{
+    send_attr(ctx, ctx->foreground, ctx->background);
+    memstream_puts(&ctx->write_buffer, funcs[T_CLEAR_SCREEN]);
+
+    if (!IS_CURSOR_HIDDEN(ctx->cursor_x, ctx->cursor_y))
+    {
+        write_cursor(ctx, ctx->cursor_x, ctx->cursor_y);
+    }
+
+    memstream_flush(&ctx->write_buffer);
+
+    // we need to invalidate cursor position too and these two vars are
+    // used only for simple cursor positioning optimization, cursor
+    // actually may be in the correct place, but we simply discard
+    // optimization once and it gives us simple solution for the case when
+    // cursor moved
+    ctx->lastx = LAST_COORD_INIT;
+    ctx->lasty = LAST_COORD_INIT;
+}
+
+// apply the size last reported by a TB_EVENT_RESIZE
+static void update_size(struct tb_context* ctx)
+{
+    uint32_t size = ctx->resize_size;
+
+    if (RESIZE_W(size) == ctx->termw && RESIZE_H(size) == ctx->termh)
+    {
+        return;
+    }
+
+    ctx->termw = RESIZE_W(size);
+    ctx->termh = RESIZE_H(size);
+#ifndef TB_NO_MEMDEV
+    // the front buffer must never be larger than the back one
+    if (cellbuf_resize(ctx, &ctx->back_buffer, ctx->termw, ctx->termh) == 0)
+    {
+        cellbuf_resize(ctx, &ctx->front_buffer, ctx->termw, ctx->termh);
+    }
+    cellbuf_clear(ctx, &ctx->front_buffer);
+#endif
+    send_clear(ctx);
+}
+
+// read no more than the input ring can take, so nothing is ever dropped;
+// what does not fit stays in the driver until the parser has made room
+static int read_input(struct tb_context* ctx)
+{
+    char ch_buf[BUFFER_SIZE_MAX];
+    size_t len = ringbuffer_free_space(&ctx->inbuf);
+    int ret;
+
+    if (ctx->input_failed)
+    {
+        return -1; // reported once the events read before were taken
+    }
+
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    if (len > BUFFER_SIZE_MAX)
+    {
+        len = BUFFER_SIZE_MAX;
+    }
+
+    ret = read(ctx->in_fd, ch_buf, len);
+    if (ret > 0)
+    {
+        ctx->input_tick = rt_tick_get();
+        ringbuffer_push(&ctx->inbuf, ch_buf, ret);
+        input_stamp_add(ctx, ctx->inbuf.head);
+        record_input(ctx, ch_buf, ret);
+    }
+    else if (ret == 0 || (errno != EINTR && errno != EAGAIN))
+    {
+        return -1; /* end of input or read error */
+    }
+    else
+    {
+        return 0;
+    }
+
+    return ret;
+}
+
+/*
+ * Escape timeout: a sequence that is still a valid prefix (a lone ESC, half
+ * of a key or mouse sequence) is only given extra time when the line is slow.
+ * The timeout follows the observed gap between bytes of split sequences,
+ * bounded by TB_ESC_TIMEOUT_MIN and TB_ESC_TIMEOUT_MAX milliseconds.
+ */
+#ifndef TB_ESC_TIMEOUT_MIN
+#define TB_ESC_TIMEOUT_MIN 1
+#endif
+
+#ifndef TB_ESC_TIMEOUT_MAX
+#define TB_ESC_TIMEOUT_MAX 50
+#endif
+
+static int esc_timeout(struct tb_context* ctx)
+{
+    int timeout = ctx->esc_gap_avg8 * 2 / 8 + 1;
+
+    if (timeout < TB_ESC_TIMEOUT_MIN)
+    {
+        timeout = TB_ESC_TIMEOUT_MIN;
+    }
+
+    if (timeout > TB_ESC_TIMEOUT_MAX)
+    {
+        timeout = TB_ESC_TIMEOUT_MAX;
+    }
+
+    return timeout;
+}
+
+static void esc_gap_update(struct tb_context* ctx, rt_tick_t ticks)
+{
+    int ms = ticks * 1000 / RT_TICK_PER_SECOND;
+
+    if (ms > TB_ESC_TIMEOUT_MAX)
+    {
+        ms = TB_ESC_TIMEOUT_MAX;
+    }
+
+    ctx->esc_gap_avg8 += ms - ctx->esc_gap_avg8 / 8;
+}
+
+static rt_bool_t event_is_subscribed(struct tb_context* ctx, const struct tb_event* event)
+{
+    int mask;
+
+    if (event->type == TB_EVENT_PASTE)
+    {
+        mask = TB_SUBSCRIBE_PASTE;
+    }
+    else if (event->type != TB_EVENT_MOUSE)
+    {
+        mask = (event->mod & TB_MOD_RELEASE) ? TB_SUBSCRIBE_KEY_RELEASE : TB_SUBSCRIBE_KEY;
+    }
+    else if (event->key == TB_KEY_MOUSE_WHEEL_UP || event->key == TB_KEY_MOUSE_WHEEL_DOWN)
+    {
+        mask = TB_SUBSCRIBE_WHEEL;
+    }
+    else if (event->key == TB_KEY_MOUSE_RELEASE)
+    {
+        mask = TB_SUBSCRIBE_RELEASE;
+    }
+    else if (event->mod & TB_MOD_MOTION)
+    {
+        mask = TB_SUBSCRIBE_MOTION;
+    }
+    else
+    {
+        mask = TB_SUBSCRIBE_PRESS;
+    }
+
+    return (ctx->eventmask & mask) != 0;
+}
+
+// fold the motion reports with the same button state which directly follow
+// 'event' into it, keeping the latest position. Returns -1 if reading more
+// input failed, 'event' is complete all the same.
+static int coalesce_motion(struct tb_context* ctx, struct tb_event* event)
+{
+    struct tb_event next;
+    struct pollfd poll_fd;
+    // the descriptor is not ours while the application or a replay feeds us
+    rt_bool_t own_input = !ctx->input_fed && !ctx->replaying;
+    int ret = 0;
+
+    if (!(ctx->eventmask & TB_SUBSCRIBE_COALESCE) || event->type != TB_EVENT_MOUSE ||
+        !(event->mod & TB_MOD_MOTION))
+    {
+        return 0;
+    }
+
+    poll_fd.fd = ctx->in_fd;
+    poll_fd.events = POLLIN;
+
+    while (1)
+    {
+        // the next report may still be pending in the driver
+        if (own_input && poll(&poll_fd, 1, 0) > 0 &&
+            (poll_fd.revents & (POLLIN | POLLHUP | POLLERR)) && read_input(ctx) < 0)
+        {
+            own_input = RT_FALSE; // merge what is buffered, then report it
+            ret = -1;
+        }
+
+        rt_memset(&next, 0, sizeof(struct tb_event));
+        next.type = TB_EVENT_KEY;
+
+        if (extract_event(ctx, &next, RT_FALSE) != RT_TRUE)
+        {
+            break;
+        }
+
+        next.time = input_stamp_lookup(ctx, ctx->inbuf.tail - 1);
+
+        if (next.type != TB_EVENT_MOUSE || !(next.mod & TB_MOD_MOTION) ||
+            next.key != event->key)
+        {
+            ctx->parser.lookahead = next;
+            ctx->parser.has_lookahead = RT_TRUE;
+            break;
+        }
+
+        event->x = next.x;
+        event->y = next.y;
+        event->time = next.time;
+    }
+
+    return ret;
+}
+
+// extract the next complete event the application subscribed to. With
+// 'flush' set, an incomplete sequence at the end of the input is resolved
+// (the escape timeout has expired for it already).
+static rt_bool_t next_event(struct tb_context* ctx, struct tb_event* event, rt_bool_t flush)
+{
+    while (1)
+    {
+        if (ctx->parser.has_lookahead)
+        {
+            *event = ctx->parser.lookahead;
+            ctx->parser.has_lookahead = RT_FALSE;
+        }
+        else
+        {
+            rt_memset(event, 0, sizeof(struct tb_event));
+            event->type = TB_EVENT_KEY;
+
+            if (extract_event(ctx, event, flush) != RT_TRUE)
+            {
+                return RT_FALSE;
+            }
+
+            event->time = input_stamp_lookup(ctx, ctx->inbuf.tail - 1);
+        }
+
+        if (event->type == TB_EVENT_RESIZE && !resize_changed(ctx, event->w, event->h))
+        {
+            continue;
+        }
+
+        if (event_is_subscribed(ctx, event))
+        {
+            if (coalesce_motion(ctx, event) != 0)
+            {
+                ctx->input_failed = RT_TRUE;
+            }
+            return RT_TRUE;
+        }
+    }
+}
+
+static int wait_fill_event(struct tb_context* ctx, struct tb_event* event, int timeout)
+{
+    struct pollfd poll_fd[2];
+    rt_tick_t last, deadline = 0;
+    rt_bool_t expire;
+    int nfds = 1, wait, left, ret;
+
+    poll_fd[0].fd = ctx->in_fd;
+    poll_fd[0].events = POLLIN;
+    poll_fd[1].fd = ctx->resize_fd;
+    poll_fd[1].events = POLLIN;
+    poll_fd[1].revents = 0;
+    if (ctx->resize_fd >= 0)
+    {
+        nfds = 2;
+    }
+
+    if (timeout != TERMBOX_WAIT_FOREVER)
+    {
+        deadline = rt_tick_get() + rt_tick_from_millisecond(timeout);
+    }
+
+    while (1)
+    {
+        // try to extract event from input buffer, return on success
+        if (next_event(ctx, event, RT_FALSE) == RT_TRUE)
+        {
+            return event->type;
+        }
+
+        if (ctx->input_failed)
+        {
+            return -1; /* end of input or read error while coalescing */
+        }
+
+        if (parser_pending(ctx))
+        {
+            // wait for the rest of the sequence, only as long as the line
+            // is slow, then take it as it is. The caller's timeout may end
+            // the wait first, the sequence is then left for the next call.
+            last = ctx->input_tick;
+            wait = esc_timeout(ctx) -
+                (int)((rt_tick_get() - last) * 1000 / RT_TICK_PER_SECOND);
+            if (wait < 0)
+            {
+                wait = 0;
+            }
+
+            expire = RT_TRUE;
+            if (timeout != TERMBOX_WAIT_FOREVER)
+            {
+                left = (int)((int64_t)(rt_int32_t)(deadline - rt_tick_get()) * 1000 / RT_TICK_PER_SECOND);
+                if (left < wait)
+                {
+                    wait = left < 0 ? 0 : left;
+                    expire = RT_FALSE;
+                }
+            }
+
+            ret = poll(poll_fd, 1, wait);
+
+            if (ret < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (ret > 0 && (poll_fd[0].revents & POLLIN) && read_input(ctx) > 0)
+            {
+                esc_gap_update(ctx, ctx->input_tick - last);
+            }
+            else if (!expire)
+            {
+                return 0; /* timeout */
+            }
+            else if (next_event(ctx, event, RT_TRUE) == RT_TRUE)
+            {
+                return event->type;
+            }
+
+            continue;
+        }
+
+        if (resize_poll(ctx, event))
+        {
+            event->time = TB_CLOCK_US();
+            return event->type;
+        }
+
+        // wake up for the next resize probe, if one is due before the timeout
+        wait = resize_wait(ctx);
+        if (timeout != TERMBOX_WAIT_FOREVER)
+        {
+            left = (int)((int64_t)(rt_int32_t)(deadline - rt_tick_get()) * 1000 / RT_TICK_PER_SECOND);
+            if (left < 0)
+            {
+                left = 0;
+            }
+
+            if (wait < 0 || left < wait)
+            {
+                wait = left;
+            }
+        }
+
+        ret = poll(poll_fd, nfds, wait);
+        if(ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue; /* interrupted by a signal, e.g. SIGWINCH */
+            }
+
+            return -1; /* poll error */
+        }
+        else if(ret == 0)
+        {
+            if(timeout != TERMBOX_WAIT_FOREVER &&
+                (rt_int32_t)(deadline - rt_tick_get()) <= 0)
+            {
+                return 0; /* timeout */
+            }
+
+            continue; /* resize probe due, or continue waitting */
+        }
+
+#ifdef TB_USING_SIGWINCH
+        if ((poll_fd[1].revents & POLLIN) && resize_signaled(ctx, event))
+        {
+            event->time = TB_CLOCK_US();
+            return event->type;
+        }
+#endif
+
+        if(poll_fd[0].revents & POLLNVAL)
+        {
+            return -1; /* input descriptor closed */
+        }
+
+        if((poll_fd[0].revents & (POLLIN | POLLHUP | POLLERR)) && read_input(ctx) < 0)
+        {
+            return -1; /* end of input or read error */
+        }
+    }
+}
+
+#ifndef TB_USING_INPUT_THREAD
+// extract every complete event without blocking, reading whatever input is
+// already pending as the buffer drains
+static int drain_events(struct tb_context* ctx, struct tb_event* events, int max)
+{
+    struct pollfd poll_fd;
+    int n = 0;
+
+    poll_fd.fd = ctx->in_fd;
+    poll_fd.events = POLLIN;
+
+    while (n < max)
+    {
+        if (next_event(ctx, &events[n], RT_FALSE) == RT_TRUE)
+        {
+            // the paste buffer is shared, don't parse ahead into the next paste
+            if (events[n++].type == TB_EVENT_PASTE)
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        if (poll(&poll_fd, 1, 0) <= 0 || !(poll_fd.revents & POLLIN) || read_input(ctx) <= 0)
+        {
+            break;
+        }
+    }
+
+    return n;
+}
+#endif /* TB_USING_INPUT_THREAD */
+
+/*---------------------external event loop---------------------------*/
+/*
+ * For applications running their own poll()/select() loop: they wait on the
+ * descriptors from tb_get_fds() themselves, then feed termbox with
+ * tb_process_input() and take events with tb_next_event(), neither of which
+ * blocks. Since nothing waits for the escape timeout here, the time of the
+ * last input is kept to resolve an incomplete sequence once it has expired.
+ */
+#ifndef TB_USING_INPUT_THREAD
+// the escape timeout is over for the incomplete sequence
+static rt_bool_t next_timeout_expired(struct tb_context* ctx)
+{
+    return rt_tick_get() - ctx->input_tick >= rt_tick_from_millisecond(esc_timeout(ctx));
+}
+#endif
+
+int tb_ctx_get_fds(struct tb_context* ctx, int* in_fd, int* out_fd, int* resize_fd)
+{
+    if (ctx->termw == -1)
+    {
+        return -1;
+    }
+
+    if (in_fd != RT_NULL)
+    {
+        *in_fd = ctx->in_fd;
+    }
+
+    if (out_fd != RT_NULL)
+    {
+        *out_fd = ctx->write_buffer.file;
+    }
+
+    if (resize_fd != RT_NULL)
+    {
+        *resize_fd = ctx->resize_fd;
+    }
+
+    return 0;
+}
+
+int tb_ctx_process_input(struct tb_context* ctx, const char* data, int len)
+{
+    if (len < 0 || (data == RT_NULL && len > 0))
+    {
+        return TB_EINVALID_ARGUMENT;
+    }
+
+#ifdef TB_USING_INPUT_THREAD
+    // the input thread owns the input and the parser
+    (void)ctx;
+    (void)data;
+    (void)len;
+    return -1;
+#else
+    struct pollfd poll_fd;
+    rt_bool_t pending = parser_pending(ctx);
+    rt_tick_t last = ctx->input_tick;
+    size_t space;
+    int total = 0, ret = 0;
+
+    if (ctx->termw == -1)
+    {
+        return -1;
+    }
+
+    ctx->input_fed = data != RT_NULL;
+    if (data != RT_NULL)
+    {
+        // take what fits, the caller keeps the rest for after tb_next_event()
+        space = ringbuffer_free_space(&ctx->inbuf);
+        total = (size_t)len > space ? (int)space : len;
+        if (total > 0)
+        {
+            ringbuffer_push(&ctx->inbuf, data, total);
+            input_stamp_add(ctx, ctx->inbuf.head);
+            record_input(ctx, data, total);
+        }
+    }
+    else
+    {
+        poll_fd.fd = ctx->in_fd;
+        poll_fd.events = POLLIN;
+
+        while (poll(&poll_fd, 1, 0) > 0 && (poll_fd.revents & (POLLIN | POLLHUP | POLLERR)) &&
+            (ret = read_input(ctx)) > 0)
+        {
+            total += ret;
+        }
+
+        if (ret < 0 && total == 0)
+        {
+            return -1; // end of input or read error
+        }
+    }
+
+    if (total > 0)
+    {
+        if (pending)
+        {
+            esc_gap_update(ctx, rt_tick_get() - last);
+        }
+
+        ctx->input_tick = rt_tick_get();
+    }
+
+    return total;
+#endif /* TB_USING_INPUT_THREAD */
+}
+
+int tb_ctx_next_event(struct tb_context* ctx, struct tb_event* event)
+{
+#ifdef TB_USING_INPUT_THREAD
+    return tb_ctx_peek_event(ctx, event, 0);
+#else
+    if (ctx->termw == -1)
+    {
+        return -1;
+    }
+
+    if (next_event(ctx, event, RT_FALSE) == RT_TRUE ||
+        (parser_pending(ctx) && next_timeout_expired(ctx) &&
+        next_event(ctx, event, RT_TRUE) == RT_TRUE))
+    {
+        latency_events_delivered(ctx, event, 1);
+        return event->type;
+    }
+
+#ifdef TB_USING_SIGWINCH
+    if (resize_signaled(ctx, event) || resize_poll(ctx, event))
+#else
+    if (resize_poll(ctx, event))
+#endif
+    {
+        event->time = TB_CLOCK_US();
+        latency_events_delivered(ctx, event, 1);
+        return event->type;
+    }
+
+    return 0;
+#endif /* TB_USING_INPUT_THREAD */
+}
+
+int tb_ctx_next_timeout(struct tb_context* ctx)
+{
+#ifdef TB_USING_INPUT_THREAD
+    (void)ctx;
+    return -1;
+#else
+    int wait = resize_wait(ctx), left;
+
+    if (parser_pending(ctx))
+    {
+        left = esc_timeout(ctx) -
+            (int)((rt_tick_get() - ctx->input_tick) * 1000 / RT_TICK_PER_SECOND);
+        if (left < 0)
+        {
+            left = 0;
+        }
+
+        if (wait < 0 || left < wait)
+        {
+            wait = left;
+        }
+    }
+
+    return wait;
+#endif
+}
+
+/*---------------------record and replay---------------------------*/
+/*
+ * Input recording for repeatable benchmarks. Every chunk of input read is
+ * appended to the file as varint(microseconds since the previous chunk),
+ * varint(length) and the bytes, after a RECORD_MAGIC header and the escape
+ * timeout average at the start. tb_replay() feeds a recording to a fresh
+ * parser in chunks as they were read, resolving escape timeouts from the
+ * recorded gaps, so the events come out the same whether the recording is
+ * replayed in real time or as fast as possible.
+ */
+#define RECORD_MAGIC "TBR1"
+#define RECORD_MAGIC_LEN (sizeof(RECORD_MAGIC) - 1)
+
+static size_t varint_put(unsigned char* out, uint32_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80)
+    {
+        out[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+
+    out[n++] = (unsigned char)v;
+    return n;
+}
+
+static void record_input(struct tb_context* ctx, const char* data, size_t len)
+{
+    unsigned char head[10];
+    uint32_t now;
+    size_t n;
+
+    if (ctx->record_fd < 0)
+    {
+        return;
+    }
+
+    // tb_record_stop() may be closing it from another thread
+    rt_mutex_take(ctx->record_lock, RT_WAITING_FOREVER);
+    if (ctx->record_fd >= 0)
+    {
+        now = TB_CLOCK_US();
+        n = varint_put(head, now - ctx->record_time);
+        n += varint_put(head + n, (uint32_t)len);
+        ctx->record_time = now;
+
+        write(ctx->record_fd, head, n);
+        write(ctx->record_fd, data, len);
+    }
+    rt_mutex_release(ctx->record_lock);
+}
+
+int tb_ctx_record_start(struct tb_context* ctx, const char* path)
+{
+    unsigned char head[5];
+    size_t head_len;
+    int fd;
+
+    if (ctx->record_lock == RT_NULL)
+    {
+        return -1; // not initialized
+    }
+
+    tb_ctx_record_stop(ctx);
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        LOG_E("cannot open %s for recording!", path);
+        return -1;
+    }
+
+    head_len = varint_put(head, (uint32_t)ctx->esc_gap_avg8);
+    write(fd, RECORD_MAGIC, RECORD_MAGIC_LEN);
+    write(fd, head, head_len);
+    rt_mutex_take(ctx->record_lock, RT_WAITING_FOREVER);
+    ctx->record_time = TB_CLOCK_US();
+    ctx->record_fd = fd;
+    rt_mutex_release(ctx->record_lock);
+    return 0;
+}
+
+void tb_ctx_record_stop(struct tb_context* ctx)
+{
+    int fd;
+
+    if (ctx->record_lock == RT_NULL)
+    {
+        return;
+    }
+
+    rt_mutex_take(ctx->record_lock, RT_WAITING_FOREVER);
+    fd = ctx->record_fd;
+    ctx->record_fd = -1;
+    rt_mutex_release(ctx->record_lock);
+
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+#ifndef TB_USING_INPUT_THREAD
+struct replay_file
+{
+    int fd;
+    unsigned char buf[64];
+    size_t pos;
+    size_t len;
+};
+
+static int replay_getc(struct replay_file* rf)
+{
+    int ret;
+
+    if (rf->pos == rf->len)
+    {
+        ret = read(rf->fd, rf->buf, sizeof(rf->buf));
+        if (ret <= 0)
+        {
+            return -1;
+        }
+
+        rf->pos = 0;
+        rf->len = ret;
+    }
+
+    return rf->buf[rf->pos++];
+}
+
+static int replay_varint(struct replay_file* rf, uint32_t* v)
+{
+    int c, shift = 0;
+
+    *v = 0;
+    do
+    {
+        c = replay_getc(rf);
+        if (c < 0 || shift > 28)
+        {
+            return -1;
+        }
+
+        *v |= (uint32_t)(c & 0x7F) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    return 0;
+}
+
+static int replay_drain(struct tb_context* ctx, rt_bool_t flush, tb_replay_handler_t handler,
+    void* arg)
+{
+    struct tb_event event;
+    int n = 0;
+
+    while (next_event(ctx, &event, flush) == RT_TRUE)
+    {
+        latency_events_delivered(ctx, &event, 1);
+        if (handler != RT_NULL)
+        {
+            handler(&event, arg);
+        }
+        n++;
+    }
+
+    return n;
+}
+#endif /* TB_USING_INPUT_THREAD */
+
+int tb_ctx_replay(struct tb_context* ctx, const char* path, int flags,
+    tb_replay_handler_t handler, void* arg)
+{
+#ifdef TB_USING_INPUT_THREAD
+    // the input thread owns the parser
+    (void)ctx;
+    (void)path;
+    (void)flags;
+    (void)handler;
+    (void)arg;
+    return -1;
+#else
+    struct replay_file rf;
+    char chunk[BUFFER_SIZE_MAX];
+    uint32_t gap, len;
+    size_t n;
+    int c, out_fd, gap_avg8, drained, events = 0;
+
+    if (ctx->termw == -1)
+    {
+        return -1;
+    }
+
+    rf.fd = open(path, O_RDONLY);
+    if (rf.fd < 0)
+    {
+        LOG_E("cannot open %s for replay!", path);
+        return -1;
+    }
+
+    rf.pos = rf.len = 0;
+    for (n = 0; n < RECORD_MAGIC_LEN; n++)
+    {
+        if (replay_getc(&rf) != RECORD_MAGIC[n])
+        {
+            break;
+        }
+    }
+
+    if (n < RECORD_MAGIC_LEN || replay_varint(&rf, &gap) != 0)
+    {
+        LOG_E("%s is not a termbox recording!", path);
+        close(rf.fd);
+        return -1;
+    }
+
+    // start from the state the recording started from
+    clear_ringbuffer(&ctx->inbuf);
+    parser_reset(ctx);
+    gap_avg8 = ctx->esc_gap_avg8; // the live terminal's, put back at the end
+    ctx->esc_gap_avg8 = (int)gap;
+    ctx->replaying = RT_TRUE;
+
+    out_fd = ctx->write_buffer.file;
+    if (flags & TB_REPLAY_NULL_OUTPUT)
+    {
+        memstream_flush(&ctx->write_buffer);
+        ctx->write_buffer.file = -1;
+    }
+
+    while (replay_varint(&rf, &gap) == 0 && replay_varint(&rf, &len) == 0)
+    {
+        if (!(flags & TB_REPLAY_FAST) && gap >= 1000)
+        {
+            rt_thread_mdelay(gap / 1000);
+        }
+
+        if (parser_pending(ctx))
+        {
+            // the escape timeout would have expired before these bytes came,
+            // else they arrived while waiting for it, as in wait_fill_event()
+            if (gap >= (uint32_t)esc_timeout(ctx) * 1000)
+            {
+                events += replay_drain(ctx, RT_TRUE, handler, arg);
+            }
+            else
+            {
+                esc_gap_update(ctx, rt_tick_from_millisecond(gap / 1000));
+            }
+        }
+
+        while (len > 0)
+        {
+            n = 0;
+            while (n < len && n < sizeof(chunk) && (c = replay_getc(&rf)) >= 0)
+            {
+                chunk[n++] = (char)c;
+            }
+
+            if (n == 0)
+            {
+                break; // truncated recording
+            }
+
+            // make room the way the application would, by taking events
+            while (ringbuffer_free_space(&ctx->inbuf) < n)
+            {
+                drained = replay_drain(ctx, RT_FALSE, handler, arg);
+                if (drained == 0)
+                {
+                    drained = replay_drain(ctx, RT_TRUE, handler, arg);
+                }
+
+                if (drained == 0)
+                {
+                    break;
+                }
+
+                events += drained;
+            }
+
+            if (ringbuffer_free_space(&ctx->inbuf) < n)
+            {
+                break;
+            }
+
+            ringbuffer_push(&ctx->inbuf, chunk, n);
+            input_stamp_add(ctx, ctx->inbuf.head);
+            len -= n;
+            events += replay_drain(ctx, RT_FALSE, handler, arg);
+        }
+    }
+
+    events += replay_drain(ctx, RT_TRUE, handler, arg);
+    ctx->esc_gap_avg8 = gap_avg8;
+    ctx->replaying = RT_FALSE;
+    close(rf.fd);
+
+    if (flags & TB_REPLAY_NULL_OUTPUT)
+    {
+        memstream_flush(&ctx->write_buffer);
+        ctx->write_buffer.file = out_fd;
+    }
+
+    return events;
+#endif /* TB_USING_INPUT_THREAD */
+}
+
+/*---------------------input thread---------------------------*/
+#ifdef TB_USING_INPUT_THREAD
+/*
+ * Every context has an input thread of its own, which owns the input
+ * descriptor and the input ring of the context: it reads and parses
+ * continuously and hands complete events to the application through a
+ * bounded queue. 'queue_ready' counts queued events and 'queue_space' free
+ * slots, so the thread stops reading (and the driver keeps buffering) while
+ * the application is busy, instead of losing events. At the end of input or
+ * on a read error the thread queues an EVENT_INPUT_ERROR and ends. The output
+ * belongs to the application thread: a cursor position probe for the
+ * terminal size is queued as an EVENT_RESIZE_PROBE, which that thread sends
+ * when it takes it.
+ */
+#ifndef TB_INPUT_THREAD_STACK_SIZE
+#define TB_INPUT_THREAD_STACK_SIZE 2048
+#endif
+
+#ifndef TB_INPUT_THREAD_PRIORITY
+#define TB_INPUT_THREAD_PRIORITY (RT_THREAD_PRIORITY_MAX / 3)
+#endif
+
+// how often the thread checks whether it has been asked to quit
+#define INPUT_THREAD_POLL_MS 50
+
+// queued in place of an event: send the size probe, see resize_probe(), or
+// the input ended, which stays queued so that every later wait returns -1
+#define EVENT_RESIZE_PROBE 0
+#define EVENT_INPUT_ERROR 0xFF
+
+static void input_thread_entry(void* parameter)
+{
+    struct tb_context* ctx = (struct tb_context*)parameter;
+    struct tb_event event;
+    int ret;
+
+    while (!ctx->input_thread_quit)
+    {
+        ret = wait_fill_event(ctx, &event, INPUT_THREAD_POLL_MS);
+        if (ret < 0)
+        {
+            rt_memset(&event, 0, sizeof(struct tb_event));
+            event.type = EVENT_INPUT_ERROR;
+        }
+        else if (ret == 0)
+        {
+            if (!ctx->resize_cpr_due)
+            {
+                continue;
+            }
+
+            rt_memset(&event, 0, sizeof(struct tb_event));
+            event.type = EVENT_RESIZE_PROBE;
+            ctx->resize_cpr_due = RT_FALSE;
+        }
+
+        if (rt_sem_take(ctx->queue_space, RT_WAITING_FOREVER) != RT_EOK || ctx->input_thread_quit)
+        {
+            break;
+        }
+
+        ctx->event_queue[ctx->queue_head % TB_EVENT_QUEUE_SIZE] = event;
+        ctx->queue_head++;
+        rt_sem_release(ctx->queue_ready);
+
+        if (event.type == EVENT_INPUT_ERROR)
+        {
+            break; // the input is gone
+        }
+
+        // the paste buffer is shared, don't parse ahead into the next paste
+        if (event.type == TB_EVENT_PASTE)
+        {
+            rt_sem_take(ctx->paste_released, RT_WAITING_FOREVER);
+        }
+    }
+
+    rt_sem_release(ctx->input_thread_exit);
+}
+
+static void input_thread_free_sems(struct tb_context* ctx)
+{
+    if (ctx->queue_ready)
+    {
+        rt_sem_delete(ctx->queue_ready);
+    }
+
+    if (ctx->queue_space)
+    {
+        rt_sem_delete(ctx->queue_space);
+    }
+
+    if (ctx->input_thread_exit)
+    {
+        rt_sem_delete(ctx->input_thread_exit);
+    }
+
+    if (ctx->paste_released)
+    {
+        rt_sem_delete(ctx->paste_released);
+    }
+
+    ctx->queue_ready = ctx->queue_space = ctx->input_thread_exit = ctx->paste_released = RT_NULL;
+}
+
+static int input_thread_start(struct tb_context* ctx)
+{
+    rt_thread_t tid;
+
+    ctx->queue_head = ctx->queue_tail = 0;
+    ctx->input_thread_quit = 0;
+    ctx->paste_out = RT_FALSE;
+    ctx->queue_ready = rt_sem_create("tb_evt", 0, RT_IPC_FLAG_FIFO);
+    ctx->queue_space = rt_sem_create("tb_spc", TB_EVENT_QUEUE_SIZE, RT_IPC_FLAG_FIFO);
+    ctx->input_thread_exit = rt_sem_create("tb_exit", 0, RT_IPC_FLAG_FIFO);
+    ctx->paste_released = rt_sem_create("tb_pst", 0, RT_IPC_FLAG_FIFO);
+
+    if (ctx->queue_ready == RT_NULL || ctx->queue_space == RT_NULL ||
+        ctx->input_thread_exit == RT_NULL || ctx->paste_released == RT_NULL)
+    {
+        input_thread_free_sems(ctx);
+        return -1;
+    }
+
+    tid = rt_thread_create("tb_input", input_thread_entry, ctx,
+        TB_INPUT_THREAD_STACK_SIZE, TB_INPUT_THREAD_PRIORITY, 10);
+    if (tid == RT_NULL)
+    {
+        input_thread_free_sems(ctx);
+        return -1;
+    }
+
+    rt_thread_startup(tid);
+    return 0;
+}
+
+static void input_thread_stop(struct tb_context* ctx)
+{
+    if (ctx->input_thread_exit == RT_NULL)
+    {
+        return;
+    }
+
+    ctx->input_thread_quit = 1;
+    rt_sem_release(ctx->queue_space); // in case the thread waits for a free slot
+    rt_sem_release(ctx->paste_released); // or for the paste buffer
+    rt_sem_take(ctx->input_thread_exit, RT_WAITING_FOREVER);
+    input_thread_free_sems(ctx);
+}
+
+static int event_queue_wait(struct tb_context* ctx, struct tb_event* event, int timeout)
+{
+    rt_tick_t deadline = 0;
+    rt_int32_t ticks;
+
+    if (ctx->queue_ready == RT_NULL)
+    {
+        return -1;
+    }
+
+    // the paste returned by the previous call is no longer in use
+    if (ctx->paste_out)
+    {
+        ctx->paste_out = RT_FALSE;
+        rt_sem_release(ctx->paste_released);
+    }
+
+    if (timeout != TERMBOX_WAIT_FOREVER)
+    {
+        deadline = rt_tick_get() + rt_tick_from_millisecond(timeout);
+    }
+
+    do
+    {
+        ticks = RT_WAITING_FOREVER;
+        if (timeout != TERMBOX_WAIT_FOREVER)
+        {
+            ticks = (rt_int32_t)(deadline - rt_tick_get());
+            if (ticks < 0)
+            {
+                ticks = 0;
+            }
+        }
+
+        if (rt_sem_take(ctx->queue_ready, ticks) != RT_EOK)
+        {
+            return 0; /* timeout */
+        }
+
+        *event = ctx->event_queue[ctx->queue_tail % TB_EVENT_QUEUE_SIZE];
+        if (event->type == EVENT_INPUT_ERROR)
+        {
+            rt_sem_release(ctx->queue_ready);
+            return -1;
+        }
+
+        ctx->queue_tail++;
+        rt_sem_release(ctx->queue_space);
+
+        if (event->type == EVENT_RESIZE_PROBE)
+        {
+            resize_send_probe(ctx);
+        }
+    } while (event->type == EVENT_RESIZE_PROBE);
+
+    if (event->type == TB_EVENT_PASTE)
+    {
+        ctx->paste_out = RT_TRUE;
+    }
+
+    return event->type;
+}
+
+static int event_queue_drain(struct tb_context* ctx, struct tb_event* events, int max)
+{
+    int n = 0;
+
+    while (n < max && rt_sem_take(ctx->queue_ready, RT_WAITING_NO) == RT_EOK)
+    {
+        events[n] = ctx->event_queue[ctx->queue_tail % TB_EVENT_QUEUE_SIZE];
+        if (events[n].type == EVENT_INPUT_ERROR)
+        {
+            rt_sem_release(ctx->queue_ready); // left for event_queue_wait()
+            break;
+        }
+
+        ctx->queue_tail++;
+        rt_sem_release(ctx->queue_space);
+
+        if (events[n].type == EVENT_RESIZE_PROBE)
+        {
+            resize_send_probe(ctx);
+            continue;
+        }
+
+        if (events[n++].type == TB_EVENT_PASTE)
+        {
+            ctx->paste_out = RT_TRUE;
+        }
+    }
+
+    return n;
+}
+#endif /* TB_USING_INPUT_THREAD */
+
+/*-------------------termbox2--------------------------*/
+#define MAX_LIMIT RT_CONSOLEBUF_SIZE
+
+void tb_ctx_char(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg, uint32_t ch)
+{
+    struct tb_cell c = {ch, fg, bg};
+    tb_ctx_put_cell(ctx, x, y, &c);
+}
+
+// write 'n' printable ASCII characters from column 'x' on, clipped to the
+// row once instead of per cell
+static void put_ascii(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg,
+    const unsigned char* s, int n)
+{
+#ifndef TB_NO_MEMDEV
+    struct tb_cell c = {0, fg, bg};
+    struct tb_cell* cell;
+    int first = 0, last = n, i;
+
+    if ((unsigned)y >= (unsigned)ctx->back_buffer.height)
+    {
+        return;
+    }
+
+    if (x < 0)
+    {
+        first = -x;
+    }
+
+    if (x > ctx->back_buffer.width - last)
+    {
+        last = ctx->back_buffer.width - x;
+    }
+
+    cell = &CELL(&ctx->back_buffer, x + first, y);
+    for (i = first; i < last; i++)
+    {
+        c.ch = s[i];
+        *cell++ = c;
+    }
+#else
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        tb_ctx_char(ctx, x + i, y, fg, bg, s[i]);
+    }
+#endif
+}
+
+// 'n' copies of the printable ASCII character 'c' from column 'x' on
+static void put_fill(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg, char c, int n)
+{
+    unsigned char run[16];
+    int chunk;
+
+    memset(run, c, sizeof(run));
+    for (; n > 0; n -= chunk, x += chunk)
+    {
+        chunk = n < (int)sizeof(run) ? n : (int)sizeof(run);
+        put_ascii(ctx, x, y, fg, bg, run, chunk);
+    }
+}
+
+int tb_ctx_string_with_limit(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg,
+    const char *str, int limit)
+{
+    const unsigned char* s = (const unsigned char*)str;
+    size_t len = strlen(str), run;
+    uint32_t uni;
+    int i, w, l = 0;
+
+    while (len > 0 && l < limit)
+    {
+        // printable ASCII is one column per byte and needs no decoding
+        run = UTF8_PRINTABLE(s[0]) ? utf8_print_run(s, len) : 0;
+        if (run > 0)
+        {
+            if (run > (size_t)(limit - l))
+            {
+                run = limit - l;
+            }
+
+            put_ascii(ctx, x, y, fg, bg, s, (int)run);
+            s += run;
+            len -= run;
+            x += (int)run;
+            l += (int)run;
+            continue;
+        }
+
+        i = utf8_decode(&uni, s, len);
+        w = wcwidth(uni);
+
+        // a wide character that would cross the limit is left out
+        if (w > 0 && l + w > limit)
+        {
+            break;
+        }
+
+        s += i;
+        len -= i;
+
+        // control characters and combining marks take no column
+        if (w <= 0)
+        {
+            continue;
+        }
+
+        tb_ctx_char(ctx, x, y, fg, bg, uni);
+        if (x < 0 && x + w > 0)
+        {
+            // the visible half of a character cut by the left edge
+            tb_ctx_char(ctx, 0, y, fg, bg, ' ');
+        }
+
+        x += w;
+        l += w;
+    }
+
+    return l;
+}
+
+int tb_ctx_string(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg, const char *str)
+{
+    return tb_ctx_string_with_limit(ctx, x, y, fg, bg, str, MAX_LIMIT);
+}
+
+/*
+ * Formatted output straight into cells: the format and its arguments are
+ * streamed as UTF-8 bytes into a cell sink, which decodes them and places
+ * the characters from left to right until the right edge of the screen.
+ * Numbers are converted in a small buffer on the stack, nothing is shared.
+ */
+struct cell_sink
+{
+    struct tb_context* ctx;
+    int x;
+    int y;
+    uint32_t fg;
+    uint32_t bg;
+    int cols; // columns written so far
+    int limit; // columns up to the right edge
+    uint32_t state; // UTF-8 decoder state
+    uint32_t cp;
+};
+
+static void sink_char(struct cell_sink* k, uint32_t ch)
+{
+    int x = k->x + k->cols;
+    int w = UTF8_PRINTABLE(ch) ? 1 : wcwidth(ch);
+
+    if (w <= 0)
+    {
+        return;
+    }
+
+    if (k->cols + w > k->limit)
+    {
+        k->limit = k->cols; // a wide character at the edge ends the text
+        return;
+    }
+
+    tb_ctx_char(k->ctx, x, k->y, k->fg, k->bg, ch);
+    if (x < 0 && x + w > 0)
+    {
+        tb_ctx_char(k->ctx, 0, k->y, k->fg, k->bg, ' ');
+    }
+
+    k->cols += w;
+}
+
+static void sink_byte(struct cell_sink* k, unsigned char c)
+{
+    uint32_t prev = k->state;
+
+    if (prev == UTF8_ACCEPT && c < 0x80)
+    {
+        sink_char(k, c);
+        return;
+    }
+
+    k->state = utf8_step(prev, &k->cp, c);
+
+    if (k->state == UTF8_ACCEPT)
+    {
+        sink_char(k, k->cp);
+    }
+    else if (k->state == UTF8_REJECT)
+    {
+        sink_char(k, 0xFFFD);
+        k->state = UTF8_ACCEPT;
+
+        // the byte which broke the sequence starts the next one
+        if (prev != UTF8_ACCEPT)
+        {
+            sink_byte(k, c);
+        }
+    }
+}
+
+static void sink_bytes(struct cell_sink* k, const char* s, size_t len)
+{
+    while (len-- > 0 && k->cols < k->limit)
+    {
+        sink_byte(k, (unsigned char)*s++);
+    }
+}
+
+static void sink_flush(struct cell_sink* k)
+{
+    if (k->state != UTF8_ACCEPT)
+    {
+        k->state = UTF8_ACCEPT;
+        sink_char(k, 0xFFFD);
+    }
+}
+
+// printable ASCII, one column per byte, placed as a run
+static void sink_ascii(struct cell_sink* k, const char* s, int n)
+{
+    if (k->state != UTF8_ACCEPT)
+    {
+        sink_bytes(k, s, n);
+        return;
+    }
+
+    if (n > k->limit - k->cols)
+    {
+        n = k->limit - k->cols;
+    }
+
+    if (n > 0)
+    {
+        put_ascii(k->ctx, k->x + k->cols, k->y, k->fg, k->bg, (const unsigned char*)s, n);
+        k->cols += n;
+    }
+}
+
+static void sink_pad(struct cell_sink* k, char c, int n)
+{
+    static const char spaces[] = "                ";
+    static const char zeros[] = "0000000000000000";
+    const char* fill = c == '0' ? zeros : spaces;
+    int chunk;
+
+    for (; n > 0 && k->cols < k->limit; n -= chunk)
+    {
+        chunk = n < (int)sizeof(spaces) - 1 ? n : (int)sizeof(spaces) - 1;
+        sink_ascii(k, fill, chunk);
+    }
+}
+
+// columns taken by 's', at most 'max' of them; '*len' becomes the number of
+// bytes making them up
+static int utf8_columns(const char* s, int max, size_t* len)
+{
+    const unsigned char* p = (const unsigned char*)s;
+    size_t n = strlen(s), i = 0;
+    uint32_t ch;
+    int w, cols = 0, step;
+
+    while (i < n)
+    {
+        step = utf8_decode(&ch, p + i, n - i);
+        w = UTF8_PRINTABLE(ch) ? 1 : wcwidth(ch);
+        if (w > 0 && cols + w > max)
+        {
+            break;
+        }
+
+        cols += w > 0 ? w : 0;
+        i += step;
+    }
+
+    *len = i;
+    return cols;
+}
+
+// write the digits of 'v' backwards, ending at 'end'
+static char* fmt_digits(char* end, uint64_t v, unsigned base, rt_bool_t upper)
+{
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    unsigned long n;
+
+    // 64-bit division only where the value needs it
+    while (v > (unsigned long)-1)
+    {
+        *--end = digits[v % base];
+        v /= base;
+    }
+
+    n = (unsigned long)v;
+    do
+    {
+        *--end = digits[n % base];
+        n /= base;
+    } while (n);
+
+    return end;
+}
+
+#define FMT_LEFT  0x01 // '-'
+#define FMT_ZERO  0x02 // '0'
+#define FMT_PLUS  0x04 // '+'
+#define FMT_SPACE 0x08 // ' '
+#define FMT_ALT   0x10 // '#'
+
+static void fmt_number(struct cell_sink* k, uint64_t v, rt_bool_t neg, unsigned base,
+    rt_bool_t upper, int flags, int width, int prec)
+{
+    char buf[24]; // 64 bits in octal
+    char* end = buf + sizeof(buf);
+    char* digits;
+    const char* prefix = "";
+    int ndigits, zeros, pad;
+
+    if (prec == 0 && v == 0)
+    {
+        digits = end; // "%.0d" of zero prints nothing
+    }
+    else
+    {
+        digits = fmt_digits(end, v, base, upper);
+    }
+
+    ndigits = (int)(end - digits);
+
+    if (neg)
+    {
+        prefix = "-";
+    }
+    else if (flags & FMT_PLUS)
+    {
+        prefix = "+";
+    }
+    else if (flags & FMT_SPACE)
+    {
+        prefix = " ";
+    }
+    else if ((flags & FMT_ALT) && v != 0 && base == 16)
+    {
+        prefix = upper ? "0X" : "0x";
+    }
+    else if ((flags & FMT_ALT) && base == 8 && prec <= ndigits &&
+        (ndigits == 0 || digits[0] != '0'))
+    {
+        prefix = "0"; // only if the digits don't start with one already
+    }
+
+    zeros = prec > ndigits ? prec - ndigits : 0;
+    pad = width - (int)strlen(prefix) - zeros - ndigits;
+
+    if ((flags & FMT_ZERO) && !(flags & FMT_LEFT) && prec < 0 && pad > 0)
+    {
+        zeros += pad;
+        pad = 0;
+    }
+
+    if (!(flags & FMT_LEFT))
+    {
+        sink_pad(k, ' ', pad);
+    }
+
+    sink_ascii(k, prefix, (int)strlen(prefix));
+    sink_pad(k, '0', zeros);
+    sink_ascii(k, digits, ndigits);
+
+    if (flags & FMT_LEFT)
+    {
+        sink_pad(k, ' ', pad);
+    }
+}
+
+static void sink_format(struct cell_sink* k, const char* fmt, va_list ap)
+{
+    const char* start;
+    const char* str;
+    const char* p;
+    int flags, width, prec, lng, ldbl, cols;
+    size_t len;
+    int64_t sv;
+    uint64_t uv;
+    char c;
+
+    while (*fmt && k->cols < k->limit)
+    {
+        if (*fmt != '%')
+        {
+            for (p = fmt; UTF8_PRINTABLE((unsigned char)*p) && *p != '%'; p++);
+
+            if (p > fmt)
+            {
+                sink_ascii(k, fmt, (int)(p - fmt));
+                fmt = p;
+            }
+            else
+            {
+                sink_byte(k, (unsigned char)*fmt++);
+            }
+            continue;
+        }
+
+        start = fmt++;
+        flags = 0;
+        width = 0;
+        prec = -1;
+        lng = 0;
+        ldbl = 0;
+
+        for (c = *fmt; c != '\0'; c = *++fmt)
+        {
+            if (c == '-')
+            {
+                flags |= FMT_LEFT;
+            }
+            else if (c == '0')
+            {
+                flags |= FMT_ZERO;
+            }
+            else if (c == '+')
+            {
+                flags |= FMT_PLUS;
+            }
+            else if (c == ' ')
+            {
+                flags |= FMT_SPACE;
+            }
+            else if (c == '#')
+            {
+                flags |= FMT_ALT;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        if (*fmt == '*')
+        {
+            width = va_arg(ap, int);
+            if (width < 0)
+            {
+                flags |= FMT_LEFT;
+                width = -width;
+            }
+            fmt++;
+        }
+        else
+        {
+            while (*fmt >= '0' && *fmt <= '9')
+            {
+                width = width * 10 + (*fmt++ - '0');
+            }
+        }
+
+        if (*fmt == '.')
+        {
+            fmt++;
+            prec = 0;
+            if (*fmt == '*')
+            {
+                prec = va_arg(ap, int);
+                fmt++;
+            }
+            else
+            {
+                while (*fmt >= '0' && *fmt <= '9')
+                {
+                    prec = prec * 10 + (*fmt++ - '0');
+                }
+            }
+        }
+
+        // length modifiers: -2 for hh, -1 for h, 1 for l, 2 for ll. Values of
+        // h and hh are passed as int and cut back to their type once taken.
+        while (*fmt == 'h' || *fmt == 'l' || *fmt == 'z' || *fmt == 'j' || *fmt == 't' ||
+            *fmt == 'L')
+        {
+            if (*fmt == 'h')
+            {
+                lng = lng < 0 ? -2 : -1;
+            }
+            else if (*fmt == 'l')
+            {
+                lng++;
+            }
+            else if (*fmt == 'z')
+            {
+                lng = sizeof(size_t) > sizeof(long) ? 2 : 1;
+            }
+            else if (*fmt == 'j')
+            {
+                lng = sizeof(intmax_t) > sizeof(long) ? 2 : 1;
+            }
+            else if (*fmt == 't')
+            {
+                lng = sizeof(ptrdiff_t) > sizeof(long) ? 2 : 1;
+            }
+            else
+            {
+                ldbl = 1; // long double, or long long for integers as in glibc
+                lng = 2;
+            }
+            fmt++;
+        }
+
+        c = *fmt;
+        if (c == '\0')
+        {
+            sink_bytes(k, start, fmt - start);
+            break;
+        }
+        fmt++;
+
+        switch (c)
+        {
+            case 'd':
+            case 'i':
+                sv = lng >= 2 ? va_arg(ap, long long) : lng == 1 ? va_arg(ap, long) : va_arg(ap, int);
+                sv = lng == -1 ? (short)sv : lng == -2 ? (signed char)sv : sv;
+                uv = sv < 0 ? (uint64_t)0 - (uint64_t)sv : (uint64_t)sv;
+                fmt_number(k, uv, sv < 0, 10, RT_FALSE, flags, width, prec);
+                break;
+
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                uv = lng >= 2 ? va_arg(ap, unsigned long long) :
+                    lng == 1 ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+                uv = lng == -1 ? (unsigned short)uv : lng == -2 ? (unsigned char)uv : uv;
+                fmt_number(k, uv, RT_FALSE, c == 'u' ? 10 : c == 'o' ? 8 : 16,
+                    c == 'X', flags & ~(FMT_PLUS | FMT_SPACE), width, prec);
+                break;
+
+            case 'p':
+                uv = (uintptr_t)va_arg(ap, void*);
+                if (uv == 0)
+                {
+                    // as glibc prints it
+                    if (!(flags & FMT_LEFT))
+                    {
+                        sink_pad(k, ' ', width - 5);
+                    }
+                    sink_ascii(k, "(nil)", 5);
+                    if (flags & FMT_LEFT)
+                    {
+                        sink_pad(k, ' ', width - 5);
+                    }
+                    break;
+                }
+
+                fmt_number(k, uv, RT_FALSE, 16, RT_FALSE, FMT_ALT | (flags & FMT_LEFT), width, -1);
+                break;
+
+            case 'c':
+                // a Unicode code point, one character
+                cols = va_arg(ap, int);
+                if (!(flags & FMT_LEFT))
+                {
+                    sink_pad(k, ' ', width - 1);
+                }
+                sink_char(k, (uint32_t)cols);
+                if (flags & FMT_LEFT)
+                {
+                    sink_pad(k, ' ', width - 1);
+                }
+                break;
+
+            case 's':
+                // width and precision count columns, not bytes
+                str = va_arg(ap, const char*);
+                if (str == RT_NULL)
+                {
+                    str = "(null)";
+                }
+
+                cols = utf8_columns(str, prec >= 0 ? prec : k->limit - k->cols, &len);
+                if (!(flags & FMT_LEFT))
+                {
+                    sink_pad(k, ' ', width - cols);
+                }
+                sink_bytes(k, str, len);
+                sink_flush(k);
+                if (flags & FMT_LEFT)
+                {
+                    sink_pad(k, ' ', width - cols);
+                }
+                break;
+
+            case '%':
+                sink_byte(k, '%');
+                break;
+
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                // floating point is not supported, shown as it is; its
+                // argument is still taken so that the ones after it line up
+                if (ldbl)
+                {
+                    (void)va_arg(ap, long double);
+                }
+                else
+                {
+                    (void)va_arg(ap, double);
+                }
+                sink_bytes(k, start, fmt - start);
+                break;
+
+            case 'n':
+                // the count is not stored
+                (void)va_arg(ap, void*);
+                break;
+
+            default:
+                // unknown conversion: the type of its argument is unknown too,
+                // so nothing after it could be taken safely. Stop here.
+                sink_bytes(k, start, fmt - start);
+                sink_flush(k);
+                return;
+        }
+    }
+
+    sink_flush(k);
+}
+
+int tb_ctx_vstringf(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg,
+    const char *fmt, va_list ap)
 {
-    foreground = fg;
-    background = bg;
+    struct cell_sink k;
+
+    k.ctx = ctx;
+    k.x = x;
+    k.y = y;
+    k.fg = fg;
+    k.bg = bg;
+    k.cols = 0;
+    k.limit = ctx->termw > x ? ctx->termw - x : 0;
+    k.state = UTF8_ACCEPT;
+    k.cp = 0;
+
+    sink_format(&k, fmt, ap);
+    return k.cols;
 }
 
-static unsigned convertnum(uint32_t num, char* buf)
+int tb_ctx_stringf(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg,
+    const char *fmt, ...)
+{
+    va_list vl;
+    int ret;
+
+    va_start(vl, fmt);
+    ret = tb_ctx_vstringf(ctx, x, y, fg, bg, fmt, vl);
+    va_end(vl);
+    return ret;
+}
+
+void tb_ctx_empty(struct tb_context* ctx, int x, int y, uint32_t bg, int width)
+{
+    put_fill(ctx, x, y, TB_DEFAULT, bg, ' ', width);
+}
+
+/*
+ * Numeric fields for dashboards. The text is built backwards from the last
+ * digit in a small buffer on the stack, two digits per division with a
+ * lookup table, so it comes out in order and is copied into the cells as a
+ * single ASCII run together with its padding. The whole field is always
+ * written, so a shorter value overwrites the digits of a longer one.
+ */
+static const char num_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+#define NUM_BUFFER_SIZE 48 // 20 digits, 6 separators, point, 9 decimals, suffix
+
+// write 'v' in decimal backwards, ending at 'end', with 'sep' between each
+// group of three digits when it isn't 0
+static char* num_digits(char* end, uint64_t v, char sep)
+{
+    unsigned long n, r;
+
+    if (sep)
+    {
+        while (v >= 1000)
+        {
+            r = (unsigned long)(v % 1000);
+            v /= 1000;
+            end -= 3;
+            end[0] = (char)('0' + r / 100);
+            memcpy(end + 1, num_pairs + (r % 100) * 2, 2);
+            *--end = sep;
+        }
+    }
+
+    // 64-bit division only where the value needs it
+    while (v > (unsigned long)-1)
+    {
+        r = (unsigned long)(v % 100);
+        v /= 100;
+        end -= 2;
+        memcpy(end, num_pairs + r * 2, 2);
+    }
+
+    n = (unsigned long)v;
+    while (n >= 100)
+    {
+        r = n % 100;
+        n /= 100;
+        end -= 2;
+        memcpy(end, num_pairs + r * 2, 2);
+    }
+
+    if (n >= 10)
+    {
+        end -= 2;
+        memcpy(end, num_pairs + n * 2, 2);
+    }
+    else
+    {
+        *--end = (char)('0' + n);
+    }
+
+    return end;
+}
+
+// exactly 'count' decimals of 'v' backwards, ending at 'end'
+static char* num_fraction(char* end, unsigned long v, int count)
+{
+    for (; count >= 2; count -= 2)
+    {
+        end -= 2;
+        memcpy(end, num_pairs + (v % 100) * 2, 2);
+        v /= 100;
+    }
+
+    if (count > 0)
+    {
+        *--end = (char)('0' + v % 10);
+    }
+
+    return end;
+}
+
+static const unsigned long num_pow10[10] =
+{
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+// place the text from 'start' to 'end' in a field of 'width' columns, or of
+// its own length when 'width' is 0, and return the columns written
+static int num_put(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg, int width,
+    int flags, rt_bool_t neg, const char* start, const char* end)
+{
+    char sign = neg ? '-' : (flags & TB_NUM_PLUS) ? '+' : 0;
+    int len = (int)(end - start) + (sign ? 1 : 0);
+    int pad;
+
+    if (width <= 0)
+    {
+        width = len;
+    }
+    else if (len > width)
+    {
+        // a truncated number would be misread
+        put_fill(ctx, x, y, fg, bg, '#', width);
+        return width;
+    }
+
+    pad = width - len;
+
+    if (!(flags & (TB_NUM_LEFT | TB_NUM_ZERO)))
+    {
+        put_fill(ctx, x, y, fg, bg, ' ', pad);
+        x += pad;
+    }
+
+    if (sign)
+    {
+        put_ascii(ctx, x++, y, fg, bg, (const unsigned char*)&sign, 1);
+    }
+
+    if ((flags & TB_NUM_ZERO) && !(flags & TB_NUM_LEFT))
+    {
+        put_fill(ctx, x, y, fg, bg, '0', pad);
+        x += pad;
+    }
+
+    put_ascii(ctx, x, y, fg, bg, (const unsigned char*)start, (int)(end - start));
+
+    if (flags & TB_NUM_LEFT)
+    {
+        put_fill(ctx, x + (int)(end - start), y, fg, bg, ' ', pad);
+    }
+
+    return width;
+}
+
+int tb_ctx_number(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg, int width,
+    int64_t value, int flags)
+{
+    return tb_ctx_fixed(ctx, x, y, fg, bg, width, value, 0, flags);
+}
+
+int tb_ctx_fixed(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg, int width,
+    int64_t value, int decimals, int flags)
+{
+    char buf[NUM_BUFFER_SIZE];
+    char* end = buf + sizeof(buf);
+    char* start = end;
+    uint64_t v = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+
+    if (decimals < 0)
+    {
+        decimals = 0;
+    }
+    else if (decimals > TB_NUM_MAX_DECIMALS)
+    {
+        decimals = TB_NUM_MAX_DECIMALS;
+    }
+
+    if (decimals > 0)
+    {
+        start = num_fraction(start, (unsigned long)(v % num_pow10[decimals]), decimals);
+        *--start = '.';
+        v /= num_pow10[decimals];
+    }
+
+    start = num_digits(start, v, (flags & TB_NUM_GROUP) ? ',' : 0);
+    return num_put(ctx, x, y, fg, bg, width, flags, value < 0, start, end);
+}
+
+int tb_ctx_si(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg, int width,
+    int64_t value, int decimals, int flags)
+{
+    static const char prefixes[] = "kMGTPE";
+    char buf[NUM_BUFFER_SIZE];
+    char* end = buf + sizeof(buf);
+    char* start = end;
+    uint64_t v = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    uint64_t unit = 1, scaled, q, r, d;
+    unsigned base = (flags & TB_NUM_IEC) ? 1024 : 1000;
+    int scale = 0;
+
+    if (decimals < 0)
+    {
+        decimals = 0;
+    }
+    else if (decimals > 3)
+    {
+        decimals = 3;
+    }
+
+    while (scale < (int)sizeof(prefixes) - 1 && v / unit >= base)
+    {
+        unit *= base;
+        scale++;
+    }
+
+    if (scale == 0)
+    {
+        // below one k the value is exact, decimals would only be zeros
+        start = num_digits(start, v, 0);
+        return num_put(ctx, x, y, fg, bg, width, flags, value < 0, start, end);
+    }
+
+    for (;;)
+    {
+        // v / unit rounded to 'decimals', without overflowing 64 bits
+        q = v / unit;
+        r = v % unit;
+        d = unit;
+        if (d > ((uint64_t)1 << 50))
+        {
+            r >>= 20;
+            d >>= 20;
+        }
+        scaled = q * num_pow10[decimals] + (r * num_pow10[decimals] + d / 2) / d;
+
+        // 999.96k rounds to 1000.0k, which is 1.0M
+        if (scaled < base * num_pow10[decimals] || scale == (int)sizeof(prefixes) - 1)
+        {
+            break;
+        }
+
+        unit *= base;
+        scale++;
+    }
+
+    if (flags & TB_NUM_IEC)
+    {
+        *--start = 'i';
+    }
+    *--start = (flags & TB_NUM_IEC) && scale == 1 ? 'K' : prefixes[scale - 1];
+
+    if (decimals > 0)
+    {
+        start = num_fraction(start, (unsigned long)(scaled % num_pow10[decimals]), decimals);
+        *--start = '.';
+    }
+
+    start = num_digits(start, scaled / num_pow10[decimals], 0);
+    return num_put(ctx, x, y, fg, bg, width, flags, value < 0, start, end);
+}
+
+/*
+ * Colour quantizer: the closest colour of the output mode to a 24-bit one,
+ * compared in CIELAB, where distances follow the eye much better than in
+ * RGB. The conversion is in fixed point: a table linearises sRGB, another
+ * one gives the cube root, and the L*a*b* of the palette is precomputed
+ * (L, a and b times 64, D65 white). In 256 colour mode only the 8 cube
+ * points around the colour and the 2 greys around it are candidates, which
+ * is as good as searching all of them and keeps the conversion O(1). The 16
+ * system colours are left out, terminals let users change them. Results are
+ * kept in a small direct-mapped cache of the context, keyed by the output
+ * mode and colour.
+ */
+
+// sRGB component to linear light, 0 .. 65535
+static const uint16_t srgb_linear[256] =
+{
+    0, 20, 40, 60, 80, 99, 119, 139, 159, 179, 199, 219,
+    241, 264, 288, 313, 340, 367, 396, 427, 458, 491, 526, 562,
+    599, 637, 677, 718, 761, 805, 851, 898, 947, 997, 1048, 1101,
+    1156, 1212, 1270, 1330, 1391, 1453, 1517, 1583, 1651, 1720, 1790, 1863,
+    1937, 2013, 2090, 2170, 2250, 2333, 2418, 2504, 2592, 2681, 2773, 2866,
+    2961, 3058, 3157, 3258, 3360, 3464, 3570, 3678, 3788, 3900, 4014, 4129,
+    4247, 4366, 4488, 4611, 4736, 4864, 4993, 5124, 5257, 5392, 5530, 5669,
+    5810, 5953, 6099, 6246, 6395, 6547, 6700, 6856, 7014, 7174, 7335, 7500,
+    7666, 7834, 8004, 8177, 8352, 8528, 8708, 8889, 9072, 9258, 9445, 9635,
+    9828, 10022, 10219, 10417, 10619, 10822, 11028, 11235, 11446, 11658, 11873, 12090,
+    12309, 12530, 12754, 12980, 13209, 13440, 13673, 13909, 14146, 14387, 14629, 14874,
+    15122, 15371, 15623, 15878, 16135, 16394, 16656, 16920, 17187, 17456, 17727, 18001,
+    18277, 18556, 18837, 19121, 19407, 19696, 19987, 20281, 20577, 20876, 21177, 21481,
+    21787, 22096, 22407, 22721, 23038, 23357, 23678, 24002, 24329, 24658, 24990, 25325,
+    25662, 26001, 26344, 26688, 27036, 27386, 27739, 28094, 28452, 28813, 29176, 29542,
+    29911, 30282, 30656, 31033, 31412, 31794, 32179, 32567, 32957, 33350, 33745, 34143,
+    34544, 34948, 35355, 35764, 36176, 36591, 37008, 37429, 37852, 38278, 38706, 39138,
+    39572, 40009, 40449, 40891, 41337, 41785, 42236, 42690, 43147, 43606, 44069, 44534,
+    45002, 45473, 45947, 46423, 46903, 47385, 47871, 48359, 48850, 49344, 49841, 50341,
+    50844, 51349, 51858, 52369, 52884, 53401, 53921, 54445, 54971, 55500, 56032, 56567,
+    57105, 57646, 58190, 58737, 59287, 59840, 60396, 60955, 61517, 62082, 62650, 63221,
+    63795, 64372, 64952, 65535
+};
+
+// the CIELAB f(t) for t = i / 256, times 32768
+static const uint16_t lab_cbrt[257] =
+{
+    4520, 5516, 6513, 7443, 8192, 8825, 9377, 9872, 10321, 10735, 11118, 11477,
+    11815, 12134, 12438, 12727, 13004, 13269, 13525, 13771, 14008, 14238, 14460, 14676,
+    14886, 15090, 15288, 15482, 15671, 15855, 16035, 16212, 16384, 16553, 16718, 16881,
+    17040, 17196, 17350, 17501, 17649, 17795, 17939, 18080, 18219, 18356, 18491, 18624,
+    18755, 18884, 19012, 19138, 19262, 19385, 19506, 19626, 19744, 19861, 19976, 20090,
+    20203, 20315, 20425, 20534, 20643, 20750, 20855, 20960, 21064, 21167, 21268, 21369,
+    21469, 21568, 21666, 21763, 21860, 21955, 22050, 22143, 22237, 22329, 22420, 22511,
+    22601, 22690, 22779, 22867, 22954, 23041, 23127, 23212, 23297, 23381, 23465, 23547,
+    23630, 23712, 23793, 23873, 23954, 24033, 24112, 24191, 24269, 24346, 24423, 24500,
+    24576, 24652, 24727, 24801, 24876, 24950, 25023, 25096, 25168, 25241, 25312, 25384,
+    25454, 25525, 25595, 25665, 25734, 25803, 25872, 25940, 26008, 26076, 26143, 26210,
+    26276, 26342, 26408, 26474, 26539, 26604, 26668, 26733, 26797, 26860, 26924, 26987,
+    27049, 27112, 27174, 27236, 27298, 27359, 27420, 27481, 27541, 27602, 27662, 27721,
+    27781, 27840, 27899, 27958, 28016, 28074, 28132, 28190, 28248, 28305, 28362, 28419,
+    28476, 28532, 28588, 28644, 28700, 28755, 28811, 28866, 28921, 28975, 29030, 29084,
+    29138, 29192, 29246, 29299, 29352, 29405, 29458, 29511, 29564, 29616, 29668, 29720,
+    29772, 29823, 29875, 29926, 29977, 30028, 30079, 30129, 30180, 30230, 30280, 30330,
+    30379, 30429, 30478, 30528, 30577, 30626, 30674, 30723, 30771, 30820, 30868, 30916,
+    30964, 31012, 31059, 31107, 31154, 31201, 31248, 31295, 31341, 31388, 31434, 31481,
+    31527, 31573, 31619, 31665, 31710, 31756, 31801, 31846, 31891, 31936, 31981, 32026,
+    32071, 32115, 32159, 32204, 32248, 32292, 32336, 32379, 32423, 32467, 32510, 32553,
+    32596, 32639, 32682, 32725, 32768
+};
+
+// L*a*b* of colours 16 .. 255 of the 256 colour palette
+static const int16_t palette_lab[240][3] =
+{
+    {0, 0, 0}, {478, 2457, -3350}, {903, 3160, -4304}, {1307, 3822, -5205}, {1694, 4456, -6069}, {2067, 5069, -6903},
+    {2199, -2678, 2585}, {2304, -1494, -439}, {2414, -530, -1846}, {2563, 516, -3141}, {2746, 1552, -4331}, {2956, 2536, -5430},
+    {3115, -3439, 3319}, {3180, -2654, 824}, {3250, -1918, -564}, {3348, -1029, -1899}, {3474, -62, -3159}, {3624, 925, -4341},
+    {3982, -4159, 4014}, {4027, -3602, 1955}, {4075, -3042, 639}, {4145, -2320, -682}, {4236, -1483, -1963}, {4348, -577, -3187},
+    {4813, -4849, 4680}, {4846, -4431, 2971}, {4882, -3996, 1751}, {4934, -3412, 474}, {5003, -2705, -796}, {5089, -1907, -2032},
+    {5615, -5516, 5324}, {5641, -5189, 3890}, {5669, -4842, 2775}, {5710, -4364, 1562}, {5764, -3769, 323}, {5831, -3077, -905},
+    {1127, 2489, 1741}, {1347, 3053, -1891}, {1553, 3528, -3208}, {1804, 4065, -4365}, {2084, 4627, -5408}, {2382, 5195, -6371},
+    {2491, -670, 2936}, {2580, 0, 0}, {2675, 622, -1420}, {2804, 1367, -2742}, {2966, 2171, -3963}, {3155, 2986, -5096},
+    {3300, -1991, 3543}, {3360, -1431, 1100}, {3424, -880, -286}, {3515, -183, -1627}, {3632, 610, -2897}, {3773, 1452, -4094},
+    {4111, -3085, 4171}, {4153, -2635, 2143}, {4200, -2174, 833}, {4266, -1565, -488}, {4353, -844, -1772}, {4460, -45, -3002},
+    {4909, -4025, 4797}, {4941, -3662, 3106}, {4976, -3281, 1892}, {5026, -2765, 618}, {5093, -2132, -652}, {5176, -1408, -1890},
+    {5690, -4862, 5414}, {5715, -4567, 3993}, {5742, -4251, 2883}, {5782, -3815, 1673}, {5835, -3268, 435}, {5901, -2626, -793},
+    {1738, 3196, 2569}, {1879, 3567, -1018}, {2021, 3920, -2428}, {2207, 4356, -3688}, {2428, 4843, -4828}, {2675, 5358, -5875},
+    {2769, 585, 3260}, {2846, 1044, 416}, {2928, 1496, -1010}, {3042, 2068, -2350}, {3186, 2717, -3596}, {3357, 3407, -4757},
+    {3490, -860, 3770}, {3545, -433, 1381}, {3604, 0, 0}, {3688, 565, -1346}, {3797, 1228, -2626}, {3929, 1953, -3836},
+    {4248, -2134, 4336}, {4288, -1762, 2341}, {4332, -1375, 1037}, {4396, -856, -283}, {4479, -230, -1569}, {4581, 477, -2804},
+    {5012, -3238, 4922}, {5043, -2922, 3252}, {5077, -2587, 2045}, {5126, -2129, 774}, {5191, -1562, -496}, {5271, -905, -1736},
+    {5771, -4209, 5513}, {5795, -3942, 4105}, {5822, -3656, 3001}, {5861, -3258, 1793}, {5913, -2755, 557}, {5978, -2161, -671},
+    {2317, 3866, 3237}, {2415, 4129, -157}, {2518, 4395, -1609}, {2659, 4741, -2936}, {2833, 5150, -4151}, {3034, 5602, -5272},
+    {3113, 1749, 3650}, {3177, 2070, 930}, {3248, 2399, -496}, {3346, 2833, -1852}, {3472, 3347, -3124}, {3623, 3916, -4315},
+    {3741, 325, 4064}, {3790, 645, 1750}, {3844, 977, 377}, {3920, 1423, -972}, {4019, 1961, -2262}, {4140, 2568, -3486},
+    {4436, -1040, 4559}, {4473, -742, 2611}, {4515, -428, 1317}, {4574, 0, -1}, {4652, 528, -1290}, {4748, 1134, -2531},
+    {5157, -2273, 5096}, {5186, -2006, 3455}, {5219, -1721, 2257}, {5266, -1327, 991}, {5328, -834, -278}, {5405, -255, -1521},
+    {5886, -3373, 5652}, {5910, -3138, 4263}, {5936, -2885, 3167}, {5973, -2532, 1964}, {6023, -2082, 730}, {6086, -1546, -498},
+    {2872, 4507, 3782}, {2944, 4704, 673}, {3023, 4910, -791}, {3132, 5188, -2157}, {3270, 5528, -3423}, {3435, 5918, -4601},
+    {3500, 2788, 4079}, {3555, 3021, 1503}, {3614, 3266, 85}, {3698, 3599, -1281}, {3806, 4007, -2574}, {3938, 4474, -3792},
+    {4042, 1463, 4410}, {4086, 1705, 2188}, {4133, 1961, 828}, {4201, 2311, -521}, {4290, 2744, -1821}, {4400, 3245, -3059},
+    {4670, 92, 4834}, {4704, 328, 2944}, {4742, 580, 1664}, {4797, 929, 351}, {4869, 1365, -940}, {4958, 1877, -2188},
+    {5342, -1213, 5316}, {5370, -992, 3713}, {5400, -753, 2527}, {5444, -421, 1267}, {5503, 0, -1}, {5576, 500, -1245},
+    {6035, -2411, 5831}, {6058, -2209, 4466}, {6083, -1990, 3381}, {6119, -1682, 2185}, {6167, -1287, 954}, {6227, -813, -274},
+    {3407, 5127, 4302}, {3464, 5281, 1466}, {3525, 5445, 10}, {3612, 5671, -1374}, {3724, 5955, -2674}, {3860, 6288, -3894},
+    {3915, 3713, 4527}, {3961, 3890, 2108}, {4011, 4079, 707}, {4082, 4340, -662}, {4175, 4668, -1970}, {4290, 5054, -3212},
+    {4381, 2519, 4791}, {4419, 2705, 2673}, {4461, 2905, 1333}, {4522, 3182, -13}, {4601, 3532, -1318}, {4699, 3946, -2569},
+    {4943, 1198, 5150}, {4974, 1386, 3328}, {5009, 1589, 2067}, {5059, 1872, 761}, {5125, 2232, -530}, {5208, 2660, -1784},
+    {5563, -123, 5577}, {5589, 59, 4018}, {5618, 257, 2849}, {5659, 535, 1597}, {5714, 891, 332}, {5783, 1318, -913},
+    {6217, -1380, 6047}, {6238, -1208, 4712}, {6262, -1020, 3640}, {6296, -755, 2452}, {6342, -414, 1226}, {6400, 0, -1},
+    {140, 0, 0}, {350, 0, 0}, {657, 0, 0}, {970, 0, 0}, {1271, 0, 0}, {1563, 0, 0},
+    {1847, 0, 0}, {2123, 0, 0}, {2394, 0, 0}, {2659, 0, 0}, {2920, 0, 0}, {3177, 0, 0},
+    {3429, 0, 0}, {3679, 0, 0}, {3924, 0, 0}, {4167, 0, 0}, {4407, 0, 0}, {4645, 0, -1},
+    {4880, 0, -1}, {5112, 0, -1}, {5343, 0, -1}, {5571, 0, -1}, {5798, 0, -1}, {6022, 0, -1}
+};
+
+// L*a*b* of xterm's defaults for TB_BLACK .. TB_WHITE
+static const int16_t base_lab[8][3] =
+{
+    {0, 0, 0},
+    {2735, 4349, 3650},
+    {4608, -4679, 4516},
+    {5119, -1170, 5130},
+    {1910, 4811, -6552},
+    {3120, 5334, -3303},
+    {4792, -2610, -768},
+    {5820, 0, -1}
+};
+
+rt_inline int lab_f(uint32_t t)
 {
-    unsigned i, l = 0;
-    int ch;
+    uint32_t i, frac;
 
-    do
+    if (t > 65535)
     {
-        buf[l++] = '0' + (num % 10);
-        num /= 10;
+        t = 65535;
     }
-    while (num);
 
-    for (i = 0; i < l / 2; i++)
-    {
-        ch = buf[i];
-        buf[i] = buf[l - 1 - i];
-        buf[l - 1 - i] = ch;
-    }
+    i = t >> 8;
+    frac = t & 0xFF;
+    return lab_cbrt[i] + (((lab_cbrt[i + 1] - lab_cbrt[i]) * frac) >> 8);
+}
 
-    return l;
+static void color_lab(uint32_t color, int16_t* lab)
+{
+    uint32_t r = srgb_linear[color >> 16 & 0xFF];
+    uint32_t g = srgb_linear[color >> 8 & 0xFF];
+    uint32_t b = srgb_linear[color & 0xFF];
+    int fx, fy, fz;
+
+    // XYZ relative to the white point
+    fx = lab_f((r * 14218 + g * 12328 + b * 6223) >> 15);
+    fy = lab_f((r * 6966 + g * 23436 + b * 2366) >> 15);
+    fz = lab_f((r * 581 + g * 3587 + b * 28605) >> 15);
+
+    lab[0] = (int16_t)(((7424 * fy) >> 15) - 1024);
+    lab[1] = (int16_t)(32000 * (fx - fy) / 32768);
+    lab[2] = (int16_t)(12800 * (fy - fz) / 32768);
 }
 
-#define WRITE_LITERAL(X) memstream_write(&write_buffer, (X), sizeof(X) -1)
-#define WRITE_INT(X) memstream_write(&write_buffer, buf, convertnum((X), buf))
+rt_inline uint32_t lab_distance(const int16_t* p, const int16_t* q)
+{
+    int dl = p[0] - q[0], da = p[1] - q[1], db = p[2] - q[2];
+
+    return (uint32_t)(dl * dl + da * da + db * db);
+}
 
-static void write_cursor(int x, int y)
+// the level of cube_levels[] at or below 'v', at most the last but one
+rt_inline int cube_floor(int v)
 {
-    char buf[32];
-    WRITE_LITERAL("\033[");
-    WRITE_INT(y + 1);
-    WRITE_LITERAL(";");
-    WRITE_INT(x + 1);
-    WRITE_LITERAL("H");
+    return v < 95 ? 0 : v >= 215 ? 4 : (v - 55) / 40;
 }
 
-static void write_sgr(uint32_t fg, uint32_t bg)
+// the step of the grey ramp, 8 + 10 * n, at or below 'v', at most the last
+// but one
+rt_inline int gray_floor(int v)
 {
-    char buf[32];
+    return v < 18 ? 0 : v >= 228 ? 22 : (v - 8) / 10;
+}
 
-    if (outputmode != TB_OUTPUT_TRUECOLOR && fg == TB_DEFAULT && bg == TB_DEFAULT)
+static uint8_t color_quantize(struct tb_context* ctx, uint32_t color, int mode)
+{
+    int r = color >> 16 & 0xFF, g = color >> 8 & 0xFF, b = color & 0xFF;
+    uint32_t key = (uint32_t)mode << 24 | (color & 0xFFFFFF);
+    uint32_t slot = (key * 2654435761u) >> 16 & (TB_COLOR_CACHE_SIZE - 1);
+    uint32_t d, best = (uint32_t)-1;
+    int16_t lab[3];
+    int cr, cg, cb, n, i;
+    uint8_t index = 0;
+
+    if (ctx->color_cache_key[slot] == key)
     {
-        return;
+        return ctx->color_cache_value[slot];
     }
 
-    switch (outputmode)
-    {
-        case TB_OUTPUT_TRUECOLOR:
-            WRITE_LITERAL("\033[38;2;");
-            WRITE_INT(fg >> 16 & 0xFF);
-            WRITE_LITERAL(";");
-            WRITE_INT(fg >> 8 & 0xFF);
-            WRITE_LITERAL(";");
-            WRITE_INT(fg & 0xFF);
-            WRITE_LITERAL(";48;2;");
-            WRITE_INT(bg >> 16 & 0xFF);
-            WRITE_LITERAL(";");
-            WRITE_INT(bg >> 8 & 0xFF);
-            WRITE_LITERAL(";");
-            WRITE_INT(bg & 0xFF);
-            WRITE_LITERAL("m");
-            break;
+    color_lab(color, lab);
 
+    switch (mode)
+    {
         case TB_OUTPUT_256:
         case TB_OUTPUT_216:
-        case TB_OUTPUT_GRAYSCALE:
-            WRITE_LITERAL("\033[");
+            cr = cube_floor(r);
+            cg = cube_floor(g);
+            cb = cube_floor(b);
+            for (i = 0; i < 8; i++)
+            {
+                n = (cr + (i >> 2)) * 36 + (cg + (i >> 1 & 1)) * 6 + cb + (i & 1);
+                d = lab_distance(lab, palette_lab[n]);
+                if (d < best)
+                {
+                    best = d;
+                    index = (uint8_t)n;
+                }
+            }
 
-            if (fg != TB_DEFAULT)
+            if (mode == TB_OUTPUT_216)
             {
-                WRITE_LITERAL("38;5;");
-                WRITE_INT(fg);
+                break;
+            }
 
-                if (bg != TB_DEFAULT)
+            index += 16;
+            n = 216 + gray_floor((r + g + b) / 3);
+            for (i = n; i <= n + 1; i++)
+            {
+                d = lab_distance(lab, palette_lab[i]);
+                if (d < best)
                 {
-                    WRITE_LITERAL(";");
+                    best = d;
+                    index = (uint8_t)(16 + i);
                 }
             }
+            break;
 
-            if (bg != TB_DEFAULT)
+        case TB_OUTPUT_GRAYSCALE:
+            // the grey of the same lightness
+            for (i = 0; i < 24; i++)
             {
-                WRITE_LITERAL("48;5;");
-                WRITE_INT(bg);
+                n = lab[0] - palette_lab[216 + i][0];
+                d = (uint32_t)(n < 0 ? -n : n);
+                if (d < best)
+                {
+                    best = d;
+                    index = (uint8_t)i;
+                }
             }
+            break;
 
-            WRITE_LITERAL("m");
+        case TB_OUTPUT_NORMAL:
+        default:
+            for (i = 0; i < 8; i++)
+            {
+                d = lab_distance(lab, base_lab[i]);
+                if (d < best)
+                {
+                    best = d;
+                    index = (uint8_t)(TB_BLACK + i);
+                }
+            }
             break;
+    }
+
+    ctx->color_cache_key[slot] = key;
+    ctx->color_cache_value[slot] = index;
+    return index;
+}
+
+uint32_t tb_ctx_rgb(struct tb_context* ctx, uint32_t in)
+{
+    in &= 0xFFFFFF;
+
+    // 24-bit cells keep the colour, it is converted when presenting
+    if (ctx->rgbcells || ctx->outputmode == TB_OUTPUT_TRUECOLOR)
+    {
+        return in ? in : TB_TRUECOLOR_BLACK;
+    }
+
+    return color_quantize(ctx, in, ctx->outputmode);
+}
+
+/*
+ * Images drawn with half blocks: the upper half of a cell is the
+ * foreground, the lower half the background, so one cell holds two pixels
+ * above each other. Pixels are quantized as they are drawn, pairs of
+ * pixel rows at a time, and the error against the palette is spread with a
+ * 4x4 Bayer matrix or by Floyd-Steinberg. Cells get the colour index of the
+ * output mode, or with TB_OUTPUT_RGB the exact palette colour, which the
+ * conversion in send_attr() maps back to the same index.
+ */
+#define HALF_BLOCK 0x2580
+
+static const uint8_t cube_levels[6] = {0, 95, 135, 175, 215, 255};
+
+// xterm's defaults for TB_BLACK .. TB_WHITE
+static const uint32_t base_rgb[8] =
+{
+    0x000000, 0xCD0000, 0x00CD00, 0xCDCD00, 0x0000EE, 0xCD00CD, 0x00CDCD, 0xE5E5E5
+};
+
+static const uint8_t bayer4[4][4] =
+{
+    {0, 8, 2, 10},
+    {12, 4, 14, 6},
+    {3, 11, 1, 9},
+    {15, 7, 13, 5}
+};
+
+// the colour color_quantize() returned 'index' for
+static uint32_t color_palette_rgb(uint8_t index, int mode)
+{
+    uint32_t v;
+
+    switch (mode)
+    {
+        case TB_OUTPUT_256:
+            if (index >= 232)
+            {
+                v = 8 + 10 * (index - 232);
+                return v << 16 | v << 8 | v;
+            }
+            index -= 16;
+            // fall through
+        case TB_OUTPUT_216:
+            return (uint32_t)cube_levels[index / 36] << 16 |
+                (uint32_t)cube_levels[index / 6 % 6] << 8 | cube_levels[index % 6];
+
+        case TB_OUTPUT_GRAYSCALE:
+            v = 8 + 10 * index;
+            return v << 16 | v << 8 | v;
 
         case TB_OUTPUT_NORMAL:
         default:
-            WRITE_LITERAL("\033[");
+            return base_rgb[(index - TB_BLACK) & 7];
+    }
+}
+
+rt_inline int clamp_channel(int v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// one row of pixels quantized into 'out'; 'err' holds the Floyd-Steinberg
+// error of this row and 'next' receives that of the row below, both times
+// 16 with a pixel of margin on either side
+static void blit_row(struct tb_context* ctx, uint32_t* out, const uint32_t* row, int w, int py,
+    int mode, int16_t* err, int16_t* next)
+{
+    int spread = ctx->outputmode == TB_OUTPUT_GRAYSCALE ? 10 :
+        ctx->outputmode == TB_OUTPUT_NORMAL ? 160 : 40;
+    int c[3], q[3], e, i, k, off;
+    uint32_t rgb;
+    uint8_t index;
 
-            if (fg != TB_DEFAULT)
+    if (mode == TB_DITHER_FS)
+    {
+        rt_memset(next, 0, sizeof(int16_t) * 3 * (w + 2));
+    }
+
+    for (i = 0; i < w; i++)
+    {
+        rgb = row[i] & 0xFFFFFF;
+
+        if (ctx->outputmode == TB_OUTPUT_TRUECOLOR)
+        {
+            out[i] = rgb ? rgb : TB_TRUECOLOR_BLACK;
+            continue;
+        }
+
+        c[0] = rgb >> 16 & 0xFF;
+        c[1] = rgb >> 8 & 0xFF;
+        c[2] = rgb & 0xFF;
+
+        if (mode == TB_DITHER_ORDERED)
+        {
+            off = ((2 * bayer4[py & 3][i & 3] - 15) * spread) / 32;
+            for (k = 0; k < 3; k++)
             {
-                WRITE_LITERAL("3");
-                WRITE_INT(fg - 1);
+                c[k] = clamp_channel(c[k] + off);
+            }
+        }
+        else if (mode == TB_DITHER_FS)
+        {
+            for (k = 0; k < 3; k++)
+            {
+                c[k] = clamp_channel(c[k] + err[3 * (i + 1) + k] / 16);
+            }
+        }
+
+        index = color_quantize(ctx, (uint32_t)c[0] << 16 | (uint32_t)c[1] << 8 | (uint32_t)c[2],
+            ctx->outputmode);
+        rgb = color_palette_rgb(index, ctx->outputmode);
+        out[i] = !ctx->rgbcells ? index : rgb ? rgb : TB_TRUECOLOR_BLACK;
+
+        if (mode == TB_DITHER_FS)
+        {
+            q[0] = rgb >> 16 & 0xFF;
+            q[1] = rgb >> 8 & 0xFF;
+            q[2] = rgb & 0xFF;
+            for (k = 0; k < 3; k++)
+            {
+                e = c[k] - q[k];
+                err[3 * (i + 2) + k] += (int16_t)(e * 7);
+                next[3 * i + k] += (int16_t)(e * 3);
+                next[3 * (i + 1) + k] += (int16_t)(e * 5);
+                next[3 * (i + 2) + k] += (int16_t)e;
+            }
+        }
+    }
+}
+
+int tb_ctx_blit_rgb(struct tb_context* ctx, int x, int y, int w, int h, const uint32_t* pixels,
+    int stride, int mode)
+{
+    uint32_t* top, *bottom;
+    int16_t* err, *next, *swap;
+    int py, i;
+
+    if (w <= 0 || h <= 0)
+    {
+        return 0;
+    }
+
+    top = rt_malloc(sizeof(uint32_t) * 2 * w + sizeof(int16_t) * 6 * (w + 2));
+    if (top == RT_NULL)
+    {
+        return -1;
+    }
+
+    bottom = top + w;
+    err = (int16_t*)(bottom + w);
+    next = err + 3 * (w + 2);
+    rt_memset(err, 0, sizeof(int16_t) * 3 * (w + 2));
+
+    for (py = 0; py < h; py += 2)
+    {
+        blit_row(ctx, top, pixels + (size_t)py * stride, w, py, mode, err, next);
+        swap = err;
+        err = next;
+        next = swap;
+
+        if (py + 1 < h)
+        {
+            blit_row(ctx, bottom, pixels + (size_t)(py + 1) * stride, w, py + 1, mode, err, next);
+            swap = err;
+            err = next;
+            next = swap;
+        }
+        else
+        {
+            for (i = 0; i < w; i++)
+            {
+                bottom[i] = ctx->background;
+            }
+        }
+
+        for (i = 0; i < w; i++)
+        {
+            tb_ctx_char(ctx, x + i, y + py / 2, top[i], bottom[i], HALF_BLOCK);
+        }
+    }
+
+    rt_free(top);
+    return 0;
+}
+
+/*---------------------layout---------------------------*/
+/*
+ * Paragraph layout: the text is measured once into a list of lines, each a
+ * byte range of the text and its width in columns, and drawn from that list
+ * on every frame. The layout keeps a hash of the text and is only measured
+ * again when the text, the width or the mode changes.
+ */
+#ifndef TB_LAYOUT_MIN_LINES
+#define TB_LAYOUT_MIN_LINES 16
+#endif
+
+#define TB_ELLIPSIS 0x2026
+
+// a word at a time: this runs on every frame, over the whole text
+static uint32_t layout_hash(const char* text, size_t len)
+{
+    uint32_t h = 2166136261u ^ (uint32_t)len, w;
+
+    for (; len >= sizeof(w); len -= sizeof(w), text += sizeof(w))
+    {
+        rt_memcpy(&w, text, sizeof(w));
+        h = (h ^ w) * 0x9E3779B1u;
+        h ^= h >> 15;
+    }
+
+    while (len-- > 0)
+    {
+        h = (h ^ (unsigned char)*text++) * 16777619u;
+    }
+
+    return h;
+}
+
+static int layout_add(struct tb_layout* layout, size_t start, size_t end, int cols, int ellipsis)
+{
+    struct tb_line* lines;
+    int capacity;
+
+    if (layout->count == layout->capacity)
+    {
+        capacity = layout->capacity ? layout->capacity * 2 : TB_LAYOUT_MIN_LINES;
+        lines = rt_realloc(layout->lines, sizeof(struct tb_line) * capacity);
+        if (lines == RT_NULL)
+        {
+            return -1;
+        }
+
+        layout->lines = lines;
+        layout->capacity = capacity;
+    }
+
+    lines = &layout->lines[layout->count++];
+    lines->start = (uint32_t)start;
+    lines->len = (uint32_t)(end - start);
+    lines->cols = (uint16_t)cols;
+    lines->ellipsis = (uint16_t)ellipsis;
+    return 0;
+}
+
+// lay out the paragraph starting at '*pos' and move it to the next one
+static int layout_paragraph(struct tb_layout* layout, const char* text, size_t len, size_t* pos)
+{
+    const unsigned char* p = (const unsigned char*)text;
+    size_t i = *pos, start = i, brk = i, fit = i;
+    int cols = 0, brk_cols = 0, fit_cols = 0, w, step;
+    uint32_t ch;
+
+    for (;;)
+    {
+        if (i == len || p[i] == '\n')
+        {
+            *pos = i < len ? i + 1 : len;
+            return layout_add(layout, start, i, cols, 0);
+        }
+
+        if (UTF8_PRINTABLE(p[i]))
+        {
+            ch = p[i];
+            step = 1;
+            w = 1;
+        }
+        else
+        {
+            step = utf8_decode(&ch, p + i, len - i);
+            w = wcwidth(ch);
+            if (w < 0)
+            {
+                w = 0; // control characters take no room
+            }
+        }
+
+        // a word may end before a run of spaces
+        if (ch == ' ' && i > start && p[i - 1] != ' ')
+        {
+            brk = i;
+            brk_cols = cols;
+        }
+
+        if (cols + w > layout->width)
+        {
+            if (layout->mode == TB_WRAP_ELLIPSIS)
+            {
+                while (i < len && p[i] != '\n')
+                {
+                    i++;
+                }
+                *pos = i < len ? i + 1 : len;
+                return layout_add(layout, start, fit, fit_cols, 1);
+            }
+
+            if (layout->mode == TB_WRAP_WORD && brk > start)
+            {
+                i = brk;
+                cols = brk_cols;
+            }
+            else if (i == start)
+            {
+                // wider than the box: a line of its own, which is not drawn
+                i += step;
+                cols = 0;
+            }
+
+            if (layout_add(layout, start, i, cols, 0) < 0)
+            {
+                return -1;
+            }
+
+            // the spaces at a word break are dropped with it
+            if (layout->mode == TB_WRAP_WORD)
+            {
+                while (i < len && p[i] == ' ')
+                {
+                    i++;
+                }
 
-                if (bg != TB_DEFAULT)
+                // and so is the end of the paragraph right after them
+                if (i == len || p[i] == '\n')
                 {
-                    WRITE_LITERAL(";");
+                    *pos = i < len ? i + 1 : len;
+                    return 0;
                 }
             }
 
-            if (bg != TB_DEFAULT)
+            start = brk = fit = i;
+            cols = brk_cols = fit_cols = 0;
+            continue;
+        }
+
+        cols += w;
+        i += step;
+
+        // the longest part which leaves a column for the ellipsis
+        if (cols < layout->width)
+        {
+            fit = i;
+            fit_cols = cols;
+        }
+    }
+}
+
+int tb_layout_text(struct tb_layout* layout, const char* text, int width, int mode)
+{
+    size_t len = strlen(text), i = 0;
+    uint32_t hash = layout_hash(text, len);
+
+    if (width > UINT16_MAX)
+    {
+        width = UINT16_MAX;
+    }
+
+    layout->text = text;
+    if (layout->valid && layout->len == len && layout->hash == hash &&
+        layout->width == width && layout->mode == mode)
+    {
+        return layout->count;
+    }
+
+    layout->len = len;
+    layout->hash = hash;
+    layout->width = width;
+    layout->mode = mode;
+    layout->count = 0;
+    layout->valid = 0;
+
+    if (width > 0)
+    {
+        while (i < len)
+        {
+            if (layout_paragraph(layout, text, len, &i) < 0)
+            {
+                layout->count = 0;
+                return -1;
+            }
+        }
+    }
+
+    layout->valid = 1;
+    return layout->count;
+}
+
+void tb_layout_free(struct tb_layout* layout)
+{
+    rt_free(layout->lines);
+    rt_memset(layout, 0, sizeof(struct tb_layout));
+}
+
+int tb_ctx_layout_draw(struct tb_context* ctx, const struct tb_layout* layout, int x, int y,
+    int height, int first, uint32_t fg, uint32_t bg)
+{
+    const struct tb_line* line;
+    const unsigned char* s;
+    struct cell_sink k;
+    size_t len, run;
+    int row, drawn = 0;
+
+    k.ctx = ctx;
+    k.fg = fg;
+    k.bg = bg;
+
+    for (row = 0; row < height; row++)
+    {
+        if (first + row < 0 || first + row >= layout->count)
+        {
+            put_fill(ctx, x, y + row, fg, bg, ' ', layout->width);
+            continue;
+        }
+
+        line = &layout->lines[first + row];
+        s = (const unsigned char*)layout->text + line->start;
+        len = line->len;
+
+        k.x = x;
+        k.y = y + row;
+        k.cols = 0;
+        k.limit = line->cols;
+        k.state = UTF8_ACCEPT;
+        k.cp = 0;
+
+        while (len > 0 && k.cols < k.limit)
+        {
+            run = UTF8_PRINTABLE(s[0]) ? utf8_print_run(s, len) : 0;
+            if (run > 0)
             {
-                WRITE_LITERAL("4");
-                WRITE_INT(bg - 1);
+                sink_ascii(&k, (const char*)s, (int)run);
+            }
+            else
+            {
+                sink_byte(&k, s[0]);
+                run = 1;
             }
+            s += run;
+            len -= run;
+        }
+        sink_flush(&k);
+
+        if (line->ellipsis)
+        {
+            k.limit = layout->width;
+            sink_char(&k, TB_ELLIPSIS);
+        }
 
-            WRITE_LITERAL("m");
-            break;
+        put_fill(ctx, x + k.cols, y + row, fg, bg, ' ', layout->width - k.cols);
+        drawn++;
     }
+
+    return drawn;
 }
 
-#ifndef TB_NO_MEMDEV
-static void cellbuf_init(struct cellbuf* buf, int width, int height)
+/*---------------------stats---------------------------*/
+void tb_ctx_get_mem_stats(struct tb_context* ctx, struct tb_mem_stats* stats)
 {
-    buf->cells = (struct tb_cell*)rt_malloc(sizeof(struct tb_cell) * width * height);
-    if(buf->cells == RT_NULL)
+    rt_memset(stats, 0, sizeof(struct tb_mem_stats));
+
+    if (ctx->termw == -1)
     {
-        LOG_E("cellbuf_init malloc error!");
+        return;
     }
 
-    buf->width = width;
-    buf->height = height;
+#ifndef TB_NO_MEMDEV
+    stats->back_buffer_bytes =
+        sizeof(struct tb_cell) * ctx->back_buffer.width * ctx->back_buffer.height;
+    stats->front_buffer_bytes =
+        sizeof(struct tb_cell) * ctx->front_buffer.width * ctx->front_buffer.height;
+#endif
+    stats->input_buffer_bytes = ctx->inbuf.size;
+    stats->input_buffer_used = ringbuffer_data_size(&ctx->inbuf);
+    stats->input_buffer_high_water = ctx->inbuf.high_water;
+    stats->input_buffer_dropped = ctx->inbuf.dropped;
+    stats->output_buffer_bytes = ctx->write_buffer.capa;
+    stats->output_flush_count = ctx->write_buffer.flush_count;
+    stats->output_overflow_count = ctx->write_buffer.overflow_count;
+    stats->output_bytes_written = ctx->write_buffer.bytes_written;
+    stats->paste_buffer_bytes = ctx->paste_capa;
 }
 
-static void cellbuf_resize(struct cellbuf* buf, int width, int height)
+void tb_ctx_get_latency_stats(struct tb_context* ctx, struct tb_latency_stats* stats)
 {
-    if (buf->width == width && buf->height == height)
-    {
-        return;
-    }
+    uint32_t sorted[TB_LATENCY_SAMPLES];
+    uint32_t n, v;
+    int stage, i, j;
 
-    if(buf->cells == RT_NULL)
+    rt_memset(stats, 0, sizeof(struct tb_latency_stats));
+
+    for (stage = 0; stage < TB_LATENCY_STAGES; stage++)
     {
-        return;
+        n = ctx->latency[stage].count < TB_LATENCY_SAMPLES ?
+            ctx->latency[stage].count : TB_LATENCY_SAMPLES;
+        if (n == 0)
+        {
+            continue;
+        }
+
+        // insertion sort, the window is small
+        for (i = 0; i < (int)n; i++)
+        {
+            v = ctx->latency[stage].samples[i];
+            for (j = i; j > 0 && sorted[j - 1] > v; j--)
+            {
+                sorted[j] = sorted[j - 1];
+            }
+            sorted[j] = v;
+        }
+
+        stats->samples[stage] = n;
+        stats->p50[stage] = sorted[(n - 1) * 50 / 100];
+        stats->p99[stage] = sorted[(n - 1) * 99 / 100];
+        stats->max[stage] = sorted[n - 1];
     }
+}
 
-    int oldw = buf->width;
-    int oldh = buf->height;
-    struct tb_cell* oldcells = buf->cells;
+void tb_ctx_reset_latency_stats(struct tb_context* ctx)
+{
+    rt_memset(ctx->latency, 0, sizeof(ctx->latency));
+    ctx->latency_pending = RT_FALSE;
+}
 
-    cellbuf_init(buf, width, height);
-    cellbuf_clear(buf);
+#ifdef RT_USING_FINSH
+#include <finsh.h>
+static int tb_mem(int argc, char** argv)
+{
+    struct tb_mem_stats st;
 
-    int minw = (width < oldw) ? width : oldw;
-    int minh = (height < oldh) ? height : oldh;
-    int i;
+    (void)argc;
+    (void)argv;
 
-    for (i = 0; i < minh; ++i)
+    if (tb_width() < 0)
     {
-        struct tb_cell* csrc = oldcells + (i * oldw);
-        struct tb_cell* cdst = buf->cells + (i * width);
-        rt_memcpy(cdst, csrc, sizeof(struct tb_cell) * minw);
+        rt_kprintf("termbox is not initialized\n");
+        return -1;
     }
 
-    rt_free(oldcells);
+    tb_get_mem_stats(&st);
+    rt_kprintf("back buffer:   %u bytes\n", (unsigned int)st.back_buffer_bytes);
+    rt_kprintf("front buffer:  %u bytes\n", (unsigned int)st.front_buffer_bytes);
+    rt_kprintf("input buffer:  %u bytes, used %u, high water %u, dropped %u\n",
+        (unsigned int)st.input_buffer_bytes, (unsigned int)st.input_buffer_used,
+        (unsigned int)st.input_buffer_high_water, (unsigned int)st.input_buffer_dropped);
+    rt_kprintf("output buffer: %u bytes, %u flushes (%u on overflow), %u bytes written\n",
+        (unsigned int)st.output_buffer_bytes, (unsigned int)st.output_flush_count,
+        (unsigned int)st.output_overflow_count, (unsigned int)st.output_bytes_written);
+    rt_kprintf("paste buffer:  %u bytes\n", (unsigned int)st.paste_buffer_bytes);
+    return 0;
 }
+MSH_CMD_EXPORT(tb_mem, show termbox memory and buffer usage)
 
-static void cellbuf_clear(struct cellbuf* buf)
+static int tb_latency(int argc, char** argv)
 {
+    static const char* const names[TB_LATENCY_STAGES] =
+    {
+        "gather", "app", "diff", "write", "total"
+    };
+    struct tb_latency_stats st;
     int i;
-    int ncells = buf->width * buf->height;
 
-    if(buf->cells == RT_NULL)
+    if (argc > 1 && strcmp(argv[1], "reset") == 0)
     {
-        return;
+        tb_reset_latency_stats();
+        return 0;
     }
 
-    for (i = 0; i < ncells; ++i)
+    tb_get_latency_stats(&st);
+    rt_kprintf("stage    samples      p50 us      p99 us      max us\n");
+    for (i = 0; i < TB_LATENCY_STAGES; i++)
     {
-        buf->cells[i].ch = ' ';
-        buf->cells[i].fg = foreground;
-        buf->cells[i].bg = background;
+        rt_kprintf("%-8s %7u %11u %11u %11u\n", names[i],
+            (unsigned int)st.samples[i], (unsigned int)st.p50[i],
+            (unsigned int)st.p99[i], (unsigned int)st.max[i]);
     }
+    return 0;
 }
+MSH_CMD_EXPORT(tb_latency, show termbox input-to-photon latency (tb_latency [reset]))
 
-static void cellbuf_free(struct cellbuf* buf)
-{
-    rt_free(buf->cells);
-}
-#endif /* TB_NO_MEMDEV */
-
-static void update_term_size(void)
+static int tb_record(int argc, char** argv)
 {
-    struct winsize sz;
-    rt_memset(&sz, 0, sizeof(sz));
+    if (argc < 2)
+    {
+        rt_kprintf("usage: tb_record <file> | stop\n");
+        return -1;
+    }
 
-    if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &sz) < 0)
+    if (strcmp(argv[1], "stop") == 0)
     {
-        /* use default value if we cannot get the window size */
-        termw = 80;
-        termh = 24;
+        tb_record_stop();
+        return 0;
     }
 
-    termw = sz.ws_col > 0 ? sz.ws_col : 80;
-    termh = sz.ws_row > 0 ? sz.ws_row : 24;
+    return tb_record_start(argv[1]);
 }
+MSH_CMD_EXPORT(tb_record, record termbox input to a file (tb_record <file> | stop))
+#endif /* RT_USING_FINSH */
 
-static void send_attr(uint32_t fg, uint32_t bg)
-{
-#define LAST_ATTR_INIT 0xFFFFFFFF
-    static uint32_t lastfg = LAST_ATTR_INIT, lastbg = LAST_ATTR_INIT;
+/*---------------------default context---------------------------*/
+static struct tb_context default_ctx;
+static rt_bool_t default_ctx_ready;
 
-    if (fg != lastfg || bg != lastbg)
+static struct tb_context* default_context(void)
+{
+    if (!default_ctx_ready)
     {
-        memstream_puts(&write_buffer, funcs[T_SGR0]);
-        uint32_t fgcol;
-        uint32_t bgcol;
-
-        switch (outputmode)
-        {
-            case TB_OUTPUT_TRUECOLOR:
-                fgcol = fg;
-                bgcol = bg;
-                break;
-
-            case TB_OUTPUT_256:
-                fgcol = fg & 0xFF;
-                bgcol = bg & 0xFF;
-                break;
-
-            case TB_OUTPUT_216:
-                fgcol = fg & 0xFF;
-
-                if (fgcol > 215)
-                {
-                    fgcol = 7;
-                }
-
-                bgcol = bg & 0xFF;
-
-                if (bgcol > 215)
-                {
-                    bgcol = 0;
-                }
-
-                fgcol += 0x10;
-                bgcol += 0x10;
-                break;
-
-            case TB_OUTPUT_GRAYSCALE:
-                fgcol = fg & 0xFF;
-
-                if (fgcol > 23)
-                {
-                    fgcol = 23;
-                }
+        ctx_preset(&default_ctx);
+        default_ctx_ready = RT_TRUE;
+    }
 
-                bgcol = bg & 0xFF;
+    return &default_ctx;
+}
 
-                if (bgcol > 23)
-                {
-                    bgcol = 0;
-                }
+int tb_init(void)
+{
+    struct tb_context* ctx = default_context();
 
-                fgcol += 0xe8;
-                bgcol += 0xe8;
-                break;
+    if (resize_trap_init(ctx) != 0)
+    {
+        return TB_EPIPE_TRAP_ERROR;
+    }
 
-            case TB_OUTPUT_NORMAL:
-            default:
-                fgcol = fg & 0x0F;
-                bgcol = bg & 0x0F;
-        }
+    if (ctx_start(ctx, STDIN_FILENO, STDOUT_FILENO) != 0)
+    {
+        ctx_stop(ctx);
+        resize_trap_free(ctx);
+        return TB_EOUT_OF_MEMORY;
+    }
 
-        if (fg & TB_BOLD)
-        {
-            memstream_puts(&write_buffer, funcs[T_BOLD]);
-        }
+    return 0;
+}
 
-        if (bg & TB_BOLD)
-        {
-            memstream_puts(&write_buffer, funcs[T_BLINK]);
-        }
+void tb_shutdown(void)
+{
+    struct tb_context* ctx = default_context();
 
-        if (fg & TB_UNDERLINE)
-        {
-            memstream_puts(&write_buffer, funcs[T_UNDERLINE]);
-        }
+    if (ctx_stop(ctx))
+    {
+        resize_trap_free(ctx);
+    }
+}
 
-        if ((fg & TB_REVERSE) || (bg & TB_REVERSE))
-        {
-            memstream_puts(&write_buffer, funcs[T_REVERSE]);
-        }
+void tb_present(void)
+{
+    tb_ctx_present(default_context());
+}
 
-        write_sgr(fgcol, bgcol);
+void tb_set_cursor(int cx, int cy)
+{
+    tb_ctx_set_cursor(default_context(), cx, cy);
+}
 
-        lastfg = fg;
-        lastbg = bg;
-    }
-#undef LAST_ATTR_INIT
+void tb_put_cell(int x, int y, const struct tb_cell* cell)
+{
+    tb_ctx_put_cell(default_context(), x, y, cell);
 }
 
-static void send_char(int x, int y, uint32_t c)
+void tb_change_cell(int x, int y, uint32_t ch, uint32_t fg, uint32_t bg)
 {
-    char buf[7];
-    int bw = utf8_unicode_to_char(buf, c);
-    buf[bw] = '\0';
+    tb_ctx_change_cell(default_context(), x, y, ch, fg, bg);
+}
 
-    if (x - 1 != lastx || y != lasty)
-    {
-        write_cursor(x, y);
-    }
+#ifndef TB_NO_MEMDEV
+void tb_blit(int x, int y, int w, int h, const struct tb_cell* cells)
+{
+    tb_ctx_blit(default_context(), x, y, w, h, cells);
+}
 
-    lastx = x;
-    lasty = y;
+struct tb_cell* tb_cell_buffer(void)
+{
+    return tb_ctx_cell_buffer(default_context());
+}
+#endif /* TB_NO_MEMDEV */
 
-    if (!c)
-    {
-        buf[0] = ' '; // replace 0 with whitespace
-    }
+int tb_poll_event(struct tb_event* event)
+{
+    return tb_ctx_poll_event(default_context(), event);
+}
 
-    memstream_puts(&write_buffer, buf);
+int tb_peek_event(struct tb_event* event, int timeout)
+{
+    return tb_ctx_peek_event(default_context(), event, timeout);
 }
 
-static void send_clear(void)
+int tb_poll_events(struct tb_event* events, int max, int timeout)
 {
-    send_attr(foreground, background);
-    memstream_puts(&write_buffer, funcs[T_CLEAR_SCREEN]);
+    return tb_ctx_poll_events(default_context(), events, max, timeout);
+}
 
-    if (!IS_CURSOR_HIDDEN(cursor_x, cursor_y))
-    {
-        write_cursor(cursor_x, cursor_y);
-    }
+int tb_width(void)
+{
+    return tb_ctx_width(default_context());
+}
 
-    memstream_flush(&write_buffer);
+int tb_height(void)
+{
+    return tb_ctx_height(default_context());
+}
 
-    // we need to invalidate cursor position too and these two vars are
-    // used only for simple cursor positioning optimization, cursor
-    // actually may be in the correct place, but we simply discard
-    // optimization once and it gives us simple solution for the case when
-    // cursor moved
-    lastx = LAST_COORD_INIT;
-    lasty = LAST_COORD_INIT;
+void tb_clear(void)
+{
+    tb_ctx_clear(default_context());
 }
 
-static void update_size(void)
+int tb_select_input_mode(int mode)
 {
-    update_term_size();
-#ifndef TB_NO_MEMDEV
-    cellbuf_resize(&back_buffer, termw, termh);
-    cellbuf_resize(&front_buffer, termw, termh);
-    cellbuf_clear(&front_buffer);
-#endif
-    send_clear();
+    return tb_ctx_select_input_mode(default_context(), mode);
 }
 
-static int wait_fill_event(struct tb_event* event, int timeout)
+int tb_select_event_mask(int mask)
 {
-    char ch_buf[BUFFER_SIZE_MAX];
-    struct pollfd poll_fd;
-    int ret;
+    return tb_ctx_select_event_mask(default_context(), mask);
+}
 
-    poll_fd.fd = STDIN_FILENO;
-    poll_fd.events = POLLIN;
+int tb_select_output_mode(int mode)
+{
+    return tb_ctx_select_output_mode(default_context(), mode);
+}
 
-    rt_memset(event, 0, sizeof(struct tb_event));
+void tb_set_clear_attributes(uint32_t fg, uint32_t bg)
+{
+    tb_ctx_set_clear_attributes(default_context(), fg, bg);
+}
 
-    // try to extract event from input buffer, return on success
-    event->type = TB_EVENT_KEY;
-    if (extract_event(event, &inbuf, inputmode) == RT_TRUE)
-    {
-        return event->type;
-    }
+int tb_get_fds(int* in_fd, int* out_fd, int* resize_fd)
+{
+    return tb_ctx_get_fds(default_context(), in_fd, out_fd, resize_fd);
+}
 
-    while (1)
-    {
-        ret = poll(&poll_fd, 1, timeout);
-        if(ret < 0)
-        {
-            return 0; /* poll error */
-        }
-        else if(ret == 0)
-        {
-            if(timeout == TERMBOX_WAIT_FOREVER)
-            {
-                continue; /* continue waitting forever */
-            }
-            else
-            {
-                return 0; /* timeout */
-            }
-        }
+int tb_process_input(const char* data, int len)
+{
+    return tb_ctx_process_input(default_context(), data, len);
+}
 
-        if(poll_fd.revents & POLLIN)
-        {
-            ret = read(STDIN_FILENO, ch_buf, BUFFER_SIZE_MAX);
-            if(ret > 0)
-            {
-                ringbuffer_push(&inbuf, ch_buf, ret);
-            }
-        }
+int tb_next_event(struct tb_event* event)
+{
+    return tb_ctx_next_event(default_context(), event);
+}
 
-        /* get the rest of sequence */
-        while(1)
-        {
-            /* timeout:5. if the next character come in 5 ms, it will be
-                consider as a part of this sequence*/
-            ret = poll(&poll_fd, 1, 5);
-            if(ret < 0)
-            {
-                break; /* poll error */
-            }
-            else if(ret == 0)
-            {
-                break; /* timeout */
-            }
+int tb_next_timeout(void)
+{
+    return tb_ctx_next_timeout(default_context());
+}
 
-            if(poll_fd.revents & POLLIN)
-            {
-                ret = read(STDIN_FILENO, ch_buf, BUFFER_SIZE_MAX);
-                if(ret <= 0)
-                {
-                    break;
-                }
-                ringbuffer_push(&inbuf, ch_buf, ret);
-            }
-        }
+int tb_record_start(const char* path)
+{
+    return tb_ctx_record_start(default_context(), path);
+}
 
-        /* got a complete sequence and begin to analyze this sequence */
-        event->type = TB_EVENT_KEY;
-        if (extract_event(event, &inbuf, inputmode) == RT_TRUE)
-        {
-            return event->type;
-        }
-    }
+void tb_record_stop(void)
+{
+    tb_ctx_record_stop(default_context());
 }
 
-/*-------------------termbox2--------------------------*/
-#define MAX_LIMIT RT_CONSOLEBUF_SIZE
-static char _print_buf[MAX_LIMIT];
+int tb_replay(const char* path, int flags, tb_replay_handler_t handler, void* arg)
+{
+    return tb_ctx_replay(default_context(), path, flags, handler, arg);
+}
 
 void tb_char(int x, int y, uint32_t fg, uint32_t bg, uint32_t ch)
 {
-    struct tb_cell c = {ch, fg, bg};
-    tb_put_cell(x, y, &c);
+    tb_ctx_char(default_context(), x, y, fg, bg, ch);
 }
 
 int tb_string_with_limit(int x, int y, uint32_t fg, uint32_t bg, const char *str, int limit)
 {
-    uint32_t uni;
-    int w, l = 0;
-
-    while (*str && l < limit)
-    {
-        str += utf8_char_to_unicode(&uni, str);
-        tb_char(x, y, fg, bg, uni);
-        w = wcwidth(uni);
-        x = x + w;
-        l = l + w;
-    }
-
-    return l;
+    return tb_ctx_string_with_limit(default_context(), x, y, fg, bg, str, limit);
 }
 
 int tb_string(int x, int y, uint32_t fg, uint32_t bg, const char *str)
 {
-    return tb_string_with_limit(x, y, fg, bg, str, MAX_LIMIT);
+    return tb_ctx_string(default_context(), x, y, fg, bg, str);
+}
+
+int tb_vstringf(int x, int y, uint32_t fg, uint32_t bg, const char *fmt, va_list ap)
+{
+    return tb_ctx_vstringf(default_context(), x, y, fg, bg, fmt, ap);
 }
 
 int tb_stringf(int x, int y, uint32_t fg, uint32_t bg, const char *fmt, ...)
 {
     va_list vl;
+    int ret;
+
     va_start(vl, fmt);
-    rt_vsnprintf(_print_buf, sizeof(_print_buf), fmt, vl);
+    ret = tb_ctx_vstringf(default_context(), x, y, fg, bg, fmt, vl);
     va_end(vl);
-    return tb_string(x, y, fg, bg, _print_buf);
+    return ret;
 }
 
 void tb_empty(int x, int y, uint32_t bg, int width)
 {
-    rt_sprintf(_print_buf, "%*s", width, "");
-    tb_string_with_limit(x, y, TB_DEFAULT, bg, _print_buf, width);
+    tb_ctx_empty(default_context(), x, y, bg, width);
 }
 
-static const unsigned short int steps[6] = {47, 115, 155, 195, 235, 256}; // in between of each level
+int tb_number(int x, int y, uint32_t fg, uint32_t bg, int width, int64_t value, int flags)
+{
+    return tb_ctx_number(default_context(), x, y, fg, bg, width, value, flags);
+}
 
-static uint8_t _get_256_color(uint32_t color)
+int tb_fixed(int x, int y, uint32_t fg, uint32_t bg, int width, int64_t value,
+    int decimals, int flags)
 {
-  /* extract rgb values from number (e.g. 0xffcc00 -> 16763904) */
-  uint8_t rgb[3] = { 0, 0, 0 }; // r, g, b
-  rgb[0] = (color >> 16) & 0xFF; // e.g. 255
-  rgb[1] = (color >> 8)  & 0xFF; // e.g. 204
-  rgb[2] = (color >> 0)  & 0xFF; // e.g. 0
+    return tb_ctx_fixed(default_context(), x, y, fg, bg, width, value, decimals, flags);
+}
 
-  /* now, translate rgb to their most similar value between the 0-5 range */
-  int nums[3] = { 0, 0, 0 };
-  for (int c = 0; c < 3; c++) {
-    for (int i = 0; i < 6; i++) {
-      if (steps[i] > rgb[c]) {
-        nums[c] = i;
-        break;
-      }
-    }
-  }
+int tb_si(int x, int y, uint32_t fg, uint32_t bg, int width, int64_t value,
+    int decimals, int flags)
+{
+    return tb_ctx_si(default_context(), x, y, fg, bg, width, value, decimals, flags);
+}
 
-  /* 16 + (r * 36) + (g * 6) + b */
-  return 16 + (nums[0] * 36) + (nums[1] * 6) + nums[2];
+uint32_t tb_rgb(uint32_t in)
+{
+    return tb_ctx_rgb(default_context(), in);
 }
 
-static const uint8_t base_colors[8][3] =
+int tb_blit_rgb(int x, int y, int w, int h, const uint32_t* pixels, int stride, int mode)
 {
- { 1, 1, 1 }, // black
- { 1, 0, 0 }, // red
- { 0, 1, 0 }, // green
- { 1, 1, 0 }, // yellow
- { 0, 0, 1 }, // blue
- { 1, 0, 1 }, // magenta
- { 0, 1, 1 }, // cyan
- { 1, 1, 1 }  // white
-};
+    return tb_ctx_blit_rgb(default_context(), x, y, w, h, pixels, stride, mode);
+}
 
-static uint8_t _get_base_color(uint32_t color)
+int tb_layout_draw(const struct tb_layout* layout, int x, int y, int height, int first,
+    uint32_t fg, uint32_t bg)
 {
-  /* extract rgb values and round them to either 0 or 1 */
-  uint8_t rgb[3] = { 0, 0, 0 }; // r, g, b
-  rgb[0] = ((color >> 16) & 0xFF) > 128 ? 1 : 0;
-  rgb[1] = ((color >> 8)  & 0xFF) > 128 ? 1 : 0;
-  rgb[2] = ((color >> 0)  & 0xFF) > 128 ? 1 : 0;
+    return tb_ctx_layout_draw(default_context(), layout, x, y, height, first, fg, bg);
+}
 
-  for (uint8_t i = 0; i < 8; i++) {
-    if (base_colors[i][0] == rgb[0] && base_colors[i][1] == rgb[1] && base_colors[i][2] == rgb[2]) {
-      return i;
-    }
-  }
+void tb_get_mem_stats(struct tb_mem_stats* stats)
+{
+    tb_ctx_get_mem_stats(default_context(), stats);
+}
 
-  return 0; // default
+void tb_get_latency_stats(struct tb_latency_stats* stats)
+{
+    tb_ctx_get_latency_stats(default_context(), stats);
 }
 
-uint8_t tb_rgb(uint32_t in)
+void tb_reset_latency_stats(void)
 {
-  if (outputmode == TB_OUTPUT_256) {
-    return _get_256_color(in);
-  } else {
-    return _get_base_color(in);
-  }
+    tb_ctx_reset_latency_stats(default_context());
 }
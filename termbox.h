@@ -10,7 +10,9 @@
 
 #ifndef H_TERMBOX
 #define H_TERMBOX
+#include <stddef.h>
 #include <stdint.h>
+#include <stdarg.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -105,6 +107,16 @@ extern "C" {
 #define TB_MOD_ALT    0x01
 #define TB_MOD_MOTION 0x02
 
+// Further modifiers and key event flags. Shift, Ctrl and Super are reported
+// for keys encoded with modifiers (e.g. Ctrl+Arrow, Shift+F5 on xterm, or any
+// key with TB_INPUT_CSIU). Release and repeat are only reported with
+// TB_INPUT_CSIU on terminals implementing the kitty keyboard protocol.
+#define TB_MOD_SHIFT   0x04
+#define TB_MOD_CTRL    0x08
+#define TB_MOD_SUPER   0x10
+#define TB_MOD_RELEASE 0x20 // key was released
+#define TB_MOD_REPEAT  0x40 // key is held down and auto-repeats
+
 // Colors (see struct tb_cell's fg and bg fields).
 #define TB_DEFAULT 0x00
 #define TB_BLACK   0x01
@@ -124,6 +136,12 @@ extern "C" {
 #define TB_UNDERLINE 0x02000000
 #define TB_REVERSE   0x04000000
 
+// In TB_OUTPUT_TRUECOLOR, and with TB_OUTPUT_RGB, a colour of 0 is
+// TB_DEFAULT, the terminal's own colour. Black is 0 | TB_TRUECOLOR_BLACK.
+// Note that 0 used to be black in TB_OUTPUT_TRUECOLOR: code which relies on
+// that has to use TB_TRUECOLOR_BLACK now.
+#define TB_TRUECOLOR_BLACK 0x08000000
+
 // A cell, single conceptual entity on the terminal screen. The terminal screen
 // is basically a 2d array of cells. It has the following fields:
 // - 'ch' is a unicode character
@@ -137,14 +155,19 @@ typedef struct tb_cell
 }tb_cell_t;
 
 #define TB_EVENT_KEY    1
+#define TB_EVENT_RESIZE 2
 #define TB_EVENT_MOUSE  3
+#define TB_EVENT_PASTE  4
 
 // An event, single interaction from the user. The 'mod' and 'ch' fields are
 // valid if 'type' is TB_EVENT_KEY. The 'w' and 'h' fields are valid if 'type'
 // is TB_EVENT_RESIZE. The 'x' and 'y' fields are valid if 'type' is
 // TB_EVENT_MOUSE. The 'key' field is valid if 'type' is either TB_EVENT_KEY
 // or TB_EVENT_MOUSE. The fields 'key' and 'ch' are mutually exclusive; only
-// one of them can be non-zero at a time.
+// one of them can be non-zero at a time. The 'data' and 'len' fields are
+// valid if 'type' is TB_EVENT_PASTE, see TB_INPUT_PASTE. The 'time' field
+// is the monotonic time in microseconds at which the input completing the
+// event was read, see tb_get_latency_stats().
 struct tb_event
 {
     uint8_t type;
@@ -155,15 +178,22 @@ struct tb_event
     int32_t h;
     int32_t x;
     int32_t y;
+    const char* data; // pasted UTF-8 text, not NUL-terminated
+    uint32_t len; // length of 'data' in bytes
+    uint32_t time; // when the input was read, in microseconds (wraps around)
 };
 
-//  Error codes returned by tb_init(). All of them are self-explanatory, except
-//  the pipe trap error. Termbox uses unix pipes in order to deliver a message
-//  from a signal handler (SIGWINCH) to the main event reading loop. Honestly in
-//  most cases you should just check the returned code as < 0.
+//  Error codes returned by tb_init() (and TB_EINVALID_ARGUMENT by
+//  tb_process_input()). All of them are self-explanatory, except
+//  the pipe trap error. With TB_USING_SIGWINCH, termbox uses unix pipes in
+//  order to deliver a message from a signal handler (SIGWINCH) to the main
+//  event reading loop. Honestly in most cases you should just check the
+//  returned code as < 0.
 #define TB_EUNSUPPORTED_TERMINAL -1
 #define TB_EFAILED_TO_OPEN_TTY   -2
 #define TB_EPIPE_TRAP_ERROR      -3
+#define TB_EOUT_OF_MEMORY        -4 // buffers or the input thread could not be set up
+#define TB_EINVALID_ARGUMENT     -5
 
 // Initializes the termbox library. This function should be called before any
 // other functions. After successful initialization, the library must be
@@ -216,6 +246,8 @@ struct tb_cell* tb_cell_buffer(void);
 #define TB_INPUT_ESC     1 // 001
 #define TB_INPUT_ALT     2 // 010
 #define TB_INPUT_MOUSE   4 // 100
+#define TB_INPUT_PASTE   8 // 1000
+#define TB_INPUT_CSIU    16 // 10000
 
 //  Sets the termbox input mode. Termbox has two input modes:
 //  1. Esc input mode.
@@ -231,17 +263,62 @@ struct tb_cell* tb_cell_buffer(void);
 //  reason you've decided to use (TB_INPUT_ESC | TB_INPUT_ALT) combination, it
 //  will behave as if only TB_INPUT_ESC was selected.
 //
+//  TB_INPUT_PASTE can be applied the same way to enable bracketed paste. A
+//  paste is then delivered as a single TB_EVENT_PASTE event, whose 'data'
+//  points into an internal buffer which stays valid until the next call to
+//  tb_peek_event(), tb_poll_event() or tb_poll_events(). Pastes larger than
+//  TB_PASTE_BUFFER_MAX bytes are delivered as several consecutive events.
+//
+//  TB_INPUT_CSIU enables the kitty progressive keyboard enhancement protocol
+//  (CSI u) and xterm's modifyOtherKeys, where the terminal supports them.
+//  Keys then arrive unambiguously with all their modifiers, ESC no longer
+//  needs the escape timeout, and key releases can be subscribed to with
+//  TB_SUBSCRIBE_KEY_RELEASE.
+//
 //  If 'mode' is TB_INPUT_CURRENT, it returns the current input mode.
 //
 //  Default termbox input mode is TB_INPUT_ESC.
 int tb_select_input_mode(int mode);
 
+#define TB_SUBSCRIBE_CURRENT  0x00
+#define TB_SUBSCRIBE_KEY      0x01 // TB_EVENT_KEY
+#define TB_SUBSCRIBE_PRESS    0x02 // mouse button press
+#define TB_SUBSCRIBE_RELEASE  0x04 // mouse button release
+#define TB_SUBSCRIBE_MOTION   0x08 // mouse motion (TB_MOD_MOTION)
+#define TB_SUBSCRIBE_WHEEL    0x10 // mouse wheel
+#define TB_SUBSCRIBE_PASTE    0x20 // TB_EVENT_PASTE
+#define TB_SUBSCRIBE_ALL      0x3F
+#define TB_SUBSCRIBE_KEY_RELEASE 0x40 // TB_EVENT_KEY with TB_MOD_RELEASE
+#define TB_SUBSCRIBE_COALESCE 0x80
+
+//  Selects the classes of events delivered by tb_peek_event(),
+//  tb_poll_event() and tb_poll_events(). Events of other classes are dropped
+//  by the parser before they reach the application (or the input thread's
+//  queue).
+//
+//  Adding TB_SUBSCRIBE_COALESCE collapses consecutive mouse motion events
+//  with the same button state into the latest position, so a fast drag
+//  results in one event per batch of reports instead of one per report.
+//  Reports still in the driver are only read if termbox reads the input
+//  itself, not when it is passed to tb_process_input() or replayed.
+//
+//  Key releases (TB_INPUT_CSIU only) are not part of TB_SUBSCRIBE_ALL and
+//  must be subscribed to explicitly with TB_SUBSCRIBE_KEY_RELEASE.
+//
+//  TB_EVENT_RESIZE is always delivered, whatever the mask.
+//
+//  If 'mask' is TB_SUBSCRIBE_CURRENT, it returns the current mask.
+//
+//  Default mask is TB_SUBSCRIBE_ALL, without coalescing.
+int tb_select_event_mask(int mask);
+
 #define TB_OUTPUT_CURRENT   0
 #define TB_OUTPUT_NORMAL    1
 #define TB_OUTPUT_256       2
 #define TB_OUTPUT_216       3
 #define TB_OUTPUT_GRAYSCALE 4
 #define TB_OUTPUT_TRUECOLOR 5
+#define TB_OUTPUT_RGB       0x10 // flag: cells hold 0xRRGGBB in every mode
 
 // Sets the termbox output mode. Termbox has three output options:
 // 1. TB_OUTPUT_NORMAL     => [1..8]
@@ -273,10 +350,18 @@ int tb_select_input_mode(int mode);
 //   But you dont need to provide an offset.
 //
 // 5. TB_OUTPUT_TRUECOLOR  => [0x000000..0xFFFFFF]
-//   This mode supports 24-bit true color. Format is 0xRRGGBB.
+//   This mode supports 24-bit true color. Format is 0xRRGGBB. 0 is
+//   TB_DEFAULT (it used to be black), use TB_TRUECOLOR_BLACK for black.
 //
 // Execute build/src/demo/output to see its impact on your terminal.
 //
+// With the TB_OUTPUT_RGB flag, e.g. TB_OUTPUT_256 | TB_OUTPUT_RGB, cells
+// always hold colours as in TB_OUTPUT_TRUECOLOR and tb_present() converts
+// them to the closest colour of the mode when it sends them, through the
+// cache of tb_rgb(). An application can then draw once for any terminal.
+// TB_OUTPUT_RGB alone turns it on and keeps the mode, a mode without it
+// turns it off.
+//
 // If 'mode' is TB_OUTPUT_CURRENT, it returns the current output mode.
 //
 // Default termbox output mode is TB_OUTPUT_NORMAL.
@@ -293,7 +378,84 @@ int tb_peek_event(struct tb_event* event, int timeout);
 // constants) or -1 if there was an error.
 int tb_poll_event(struct tb_event* event);
 
-// Utility utf8 functions.
+// Wait for an event up to 'timeout' milliseconds like tb_peek_event(), then
+// also fill 'events' with every further event that is already complete, up
+// to 'max' events in total. Returns the number of events stored, 0 if there
+// were no event during 'timeout' period or -1 if there was an error. Use it
+// to handle a paste or a burst of mouse motion and redraw once. A paste event
+// always ends the batch, so that its 'data' stays valid.
+int tb_poll_events(struct tb_event* events, int max, int timeout);
+
+// When built with TB_USING_INPUT_THREAD, tb_init() starts a thread which reads
+// and parses input continuously into a queue of TB_EVENT_QUEUE_SIZE events;
+// tb_peek_event() and tb_poll_event() then only take events from that queue.
+// If the input ends or fails, the thread stops and they return -1 once the
+// events queued before are taken.
+
+// For applications with their own event loop (poll(), select(), epoll,
+// libuv or an RT-Thread event set), termbox can be driven without blocking
+// and without an extra thread:
+// - tb_get_fds() returns the descriptors termbox reads input from and writes
+//   output to, and with TB_USING_SIGWINCH the self-pipe which becomes
+//   readable on resize (-1 otherwise). Any pointer may be NULL. Returns -1
+//   before tb_init().
+// - tb_process_input() feeds input to the parser. With 'data' NULL and 'len'
+//   0 it reads whatever is pending on the input descriptor, otherwise it
+//   takes up to 'len' bytes the application has read itself. Returns the
+//   number of bytes taken, which is less than 'len' when the input buffer is
+//   full: drain events with tb_next_event() and feed the rest again. Returns
+//   -1 when reading hits the end of input or an error, and
+//   TB_EINVALID_ARGUMENT for a negative 'len' or NULL 'data' with a 'len'.
+// - tb_next_event() returns the next complete event like tb_peek_event()
+//   with no timeout, or 0 if there is none.
+// - tb_next_timeout() returns the number of milliseconds after which
+//   tb_next_event() should be called even without new input (escape timeout
+//   of an incomplete sequence, resize probe), or -1 if there is no such
+//   deadline. Use it as the timeout of the application's wait.
+// With TB_USING_INPUT_THREAD, the thread keeps owning the input:
+// tb_process_input() returns -1 and tb_next_event() takes from its queue.
+int tb_get_fds(int* in_fd, int* out_fd, int* resize_fd);
+int tb_process_input(const char* data, int len);
+int tb_next_event(struct tb_event* event);
+int tb_next_timeout(void);
+
+// Input recording and replay, for benchmarks that do not depend on a human at
+// a terminal. tb_record_start() appends every chunk of input termbox reads,
+// with the time since the previous one, to the file at 'path' until
+// tb_record_stop() or tb_shutdown(). tb_replay() then feeds such a recording
+// to the parser and calls 'handler' for every event, in which the
+// application can update its cells and call tb_present() as it would
+// normally. Returns the number of events or -1 on error. Flags:
+// - TB_REPLAY_FAST: do not wait for the recorded gaps between chunks.
+//   Escape timeouts are still resolved from the recorded gaps, so the events
+//   are the same as in real time. The escape timeout termbox adapted to the
+//   live terminal is kept as it was before the replay.
+// - TB_REPLAY_NULL_OUTPUT: discard the output while replaying (the output
+//   counters of tb_get_mem_stats() still count it), to measure termbox and
+//   the application alone.
+// Replay is not available with TB_USING_INPUT_THREAD.
+#define TB_REPLAY_REALTIME    0
+#define TB_REPLAY_FAST        1
+#define TB_REPLAY_NULL_OUTPUT 2
+
+typedef void (*tb_replay_handler_t)(const struct tb_event* event, void* arg);
+
+int tb_record_start(const char* path);
+void tb_record_stop(void);
+int tb_replay(const char* path, int flags, tb_replay_handler_t handler, void* arg);
+
+// A TB_EVENT_RESIZE is delivered when the terminal size changed; tb_width(),
+// tb_height() and the back buffer follow at the next tb_clear() or
+// tb_present(). Built with TB_USING_SIGWINCH, termbox learns about a resize
+// from SIGWINCH right away. Otherwise the size is probed every
+// TB_RESIZE_PROBE_INTERVAL milliseconds while waiting for input, through
+// TIOCGWINSZ or, on serial consoles without it, a cursor position report.
+
+// Utility utf8 functions. utf8_char_length() returns 0 for a byte which can't
+// start a character. utf8_char_to_unicode() validates its input: malformed
+// UTF-8 decodes to U+FFFD, one for every maximal invalid subpart, and never
+// reads past the terminating NUL. It returns the number of bytes consumed or
+// TB_EOF at the end of the string.
 #define TB_EOF -1
 int utf8_char_length(char c);
 int utf8_char_to_unicode(uint32_t* out, const char* c);
@@ -303,9 +465,224 @@ int utf8_unicode_to_char(char* out, uint32_t c);
 void tb_char(int x, int y, uint32_t fg, uint32_t bg, uint32_t ch);
 int tb_string_with_limit(int x, int y, uint32_t fg, uint32_t bg, const char * str, int limit);
 int tb_string(int x, int y, uint32_t fg, uint32_t bg, const char *str);
+// tb_stringf() formats straight into the back buffer, up to the right edge of
+// the screen, and returns the number of columns written. It understands the
+// printf flags, width, precision and the d i u x X o c s p % conversions
+// with the hh, h, l, ll, z, j and t modifiers. Width and precision of %s
+// count columns, and %c takes a Unicode code point. Floating point is not
+// supported: e f g a are shown as written, and their argument is skipped.
+// An unknown conversion is shown as written and ends the output, since the
+// arguments after it could not be found.
 int tb_stringf(int x, int y, uint32_t fg, uint32_t bg, const char * fmt, ...);
+int tb_vstringf(int x, int y, uint32_t fg, uint32_t bg, const char * fmt, va_list ap);
 void tb_empty(int x, int y, uint32_t bg, int width);
-uint8_t tb_rgb(uint32_t in);
+
+// Numeric fields, right-aligned in 'width' columns unless TB_NUM_LEFT is
+// given. The whole field is written, a value which doesn't fit fills it with
+// '#' and a 'width' of 0 takes the length of the value. They return the
+// number of columns written.
+// - tb_number(): an integer, e.g. "  -1,234" with TB_NUM_GROUP
+// - tb_fixed(): 'value' scaled by 10^decimals, tb_fixed(..., 12345, 2, 0)
+//   prints "123.45", with at most TB_NUM_MAX_DECIMALS decimals
+// - tb_si(): a prefix of 1000 ("1.23M") or with TB_NUM_IEC of 1024
+//   ("1.5Ki"), rounded to at most 3 decimals. Values below one k are
+//   printed as integers.
+#define TB_NUM_LEFT  0x01 // left-align, pad on the right
+#define TB_NUM_ZERO  0x02 // pad with zeros after the sign
+#define TB_NUM_PLUS  0x04 // '+' before positive values
+#define TB_NUM_GROUP 0x08 // ',' between groups of three digits
+#define TB_NUM_IEC   0x10 // tb_si(): binary prefixes
+#define TB_NUM_MAX_DECIMALS 9
+
+int tb_number(int x, int y, uint32_t fg, uint32_t bg, int width, int64_t value, int flags);
+int tb_fixed(int x, int y, uint32_t fg, uint32_t bg, int width, int64_t value, int decimals, int flags);
+int tb_si(int x, int y, uint32_t fg, uint32_t bg, int width, int64_t value, int decimals, int flags);
+// The closest colour of the current output mode to the 24-bit colour 'in'
+// (0xRRGGBB), ready to be used as fg or bg: TB_BLACK .. TB_WHITE in
+// TB_OUTPUT_NORMAL, an index of the cube or of the grey ramp in
+// TB_OUTPUT_256, and an index without offset in TB_OUTPUT_216 and
+// TB_OUTPUT_GRAYSCALE. Conversions are cached. In TB_OUTPUT_TRUECOLOR and
+// with TB_OUTPUT_RGB, where cells hold 24-bit colours, it returns 'in' as it
+// is, or TB_TRUECOLOR_BLACK for black.
+uint32_t tb_rgb(uint32_t in);
+
+// Draws a w x h image of 0xRRGGBB pixels at x, y with half blocks, two
+// pixels above each other per cell, so it takes (h + 1) / 2 rows. Rows of
+// pixels are 'stride' pixels apart. The colours are converted to the output
+// mode like tb_rgb() does, 'mode' chooses how the error is spread:
+// TB_DITHER_ORDERED is a 4x4 Bayer pattern which stays put from frame to
+// frame, good for moving pictures and heatmaps, TB_DITHER_FS is
+// Floyd-Steinberg, smoother for still photos. Returns 0, or -1 when out of
+// memory for the working rows.
+#define TB_DITHER_NONE    0
+#define TB_DITHER_ORDERED 1
+#define TB_DITHER_FS      2
+
+int tb_blit_rgb(int x, int y, int w, int h, const uint32_t* pixels, int stride, int mode);
+
+// Paragraph layout. tb_layout_text() splits the UTF-8 text into lines of at
+// most 'width' columns and returns their number, or -1 when out of memory.
+// A newline starts a new paragraph, control characters take no room and wide
+// characters are never split. The lines are byte ranges of the text, so it
+// has to stay in place while the layout is used. Calling tb_layout_text()
+// again with the same text, width and mode reuses the lines without
+// measuring them again, which makes it cheap to call on every frame.
+// tb_layout_draw() draws 'height' lines starting from line 'first' into a
+// box at x, y, padding every row to the width of the layout with spaces,
+// and returns the number of lines drawn. Start from a zeroed struct
+// tb_layout and release it with tb_layout_free().
+#define TB_WRAP_WORD     0 // break between words, long words anywhere
+#define TB_WRAP_CHAR     1 // break at any character
+#define TB_WRAP_ELLIPSIS 2 // one line per paragraph, cut with an ellipsis
+
+struct tb_line
+{
+    uint32_t start; // byte offset in the text
+    uint32_t len; // bytes, without the spaces or the newline ending it
+    uint16_t cols;
+    uint16_t ellipsis; // TB_WRAP_ELLIPSIS cut the paragraph here
+};
+
+struct tb_layout
+{
+    struct tb_line* lines;
+    int count;
+    int capacity;
+    const char* text;
+    size_t len;
+    uint32_t hash;
+    int width;
+    int mode;
+    int valid;
+};
+
+int tb_layout_text(struct tb_layout* layout, const char* text, int width, int mode);
+int tb_layout_draw(const struct tb_layout* layout, int x, int y, int height, int first,
+    uint32_t fg, uint32_t bg);
+void tb_layout_free(struct tb_layout* layout);
+
+// Memory and buffer usage, filled by tb_get_mem_stats(). All sizes are in
+// bytes. Use the high water mark and the overflow flush count to size
+// TB_INPUT_BUFFER_SIZE and TB_OUTPUT_BUFFER_SIZE. All fields are zero when
+// called before tb_init() or after tb_shutdown(). The 'tb_mem' MSH command
+// prints the same information.
+struct tb_mem_stats
+{
+    uint32_t back_buffer_bytes;
+    uint32_t front_buffer_bytes;
+    uint32_t input_buffer_bytes;
+    uint32_t input_buffer_used; // bytes waiting to be parsed
+    uint32_t input_buffer_high_water; // max bytes ever waiting to be parsed
+    uint32_t input_buffer_dropped; // bytes lost because the buffer was full
+    uint32_t output_buffer_bytes;
+    uint32_t output_flush_count;
+    uint32_t output_overflow_count; // flushes forced by a full output buffer
+    uint32_t output_bytes_written;
+    uint32_t paste_buffer_bytes;
+};
+
+void tb_get_mem_stats(struct tb_mem_stats* stats);
+
+// Input-to-photon latency stages, in microseconds:
+// - GATHER: input read until the event was returned to the application
+//   (parsing, escape timeout, input thread queue)
+// - APP: event returned until tb_present() was called
+// - DIFF: tb_present() comparing and encoding the back buffer
+// - WRITE: tb_present() flushing the output to the terminal
+// - TOTAL: input read until the frame presenting it was flushed
+// GATHER, APP and TOTAL are sampled once per frame which follows input,
+// starting from the oldest event returned since the previous tb_present().
+// DIFF and WRITE are sampled on every tb_present().
+#define TB_LATENCY_GATHER 0
+#define TB_LATENCY_APP    1
+#define TB_LATENCY_DIFF   2
+#define TB_LATENCY_WRITE  3
+#define TB_LATENCY_TOTAL  4
+#define TB_LATENCY_STAGES 5
+
+// Latency percentiles over the last TB_LATENCY_SAMPLES samples of each
+// stage, filled by tb_get_latency_stats(). Timestamps come from
+// TB_CLOCK_US(), which defaults to the RT-Thread tick and can be defined to a
+// finer clock when building termbox.c. The 'tb_latency' MSH command prints
+// the same information.
+struct tb_latency_stats
+{
+    uint32_t samples[TB_LATENCY_STAGES]; // samples in the window
+    uint32_t p50[TB_LATENCY_STAGES];
+    uint32_t p99[TB_LATENCY_STAGES];
+    uint32_t max[TB_LATENCY_STAGES];
+};
+
+void tb_get_latency_stats(struct tb_latency_stats* stats);
+void tb_reset_latency_stats(void);
+
+// Several terminals at once. Everything termbox keeps about a terminal is in
+// a context; the functions above work on a default one on stdin and stdout,
+// which tb_init() starts. tb_ctx_init() starts another one on any pair of
+// descriptors, a UART and a telnet connection for instance, and returns it,
+// or NULL when out of memory. tb_ctx_shutdown() restores that terminal and
+// frees the context. Every other tb_ctx_*() function does what the tb_*()
+// function of the same name does, on the given context alone, so contexts
+// can be driven from threads of their own at the same time. Only the
+// default context hears SIGWINCH, the size of the other terminals is
+// probed. With TB_USING_INPUT_THREAD every context has its input thread.
+struct tb_context;
+
+struct tb_context* tb_ctx_init(int in_fd, int out_fd);
+void tb_ctx_shutdown(struct tb_context* ctx);
+int tb_ctx_width(struct tb_context* ctx);
+int tb_ctx_height(struct tb_context* ctx);
+void tb_ctx_clear(struct tb_context* ctx);
+void tb_ctx_set_clear_attributes(struct tb_context* ctx, uint32_t fg, uint32_t bg);
+void tb_ctx_present(struct tb_context* ctx);
+void tb_ctx_set_cursor(struct tb_context* ctx, int cx, int cy);
+void tb_ctx_put_cell(struct tb_context* ctx, int x, int y, const struct tb_cell* cell);
+void tb_ctx_change_cell(struct tb_context* ctx, int x, int y, uint32_t ch, uint32_t fg,
+    uint32_t bg);
+#ifndef TB_NO_MEMDEV
+void tb_ctx_blit(struct tb_context* ctx, int x, int y, int w, int h, const struct tb_cell* cells);
+struct tb_cell* tb_ctx_cell_buffer(struct tb_context* ctx);
+#endif
+
+int tb_ctx_select_input_mode(struct tb_context* ctx, int mode);
+int tb_ctx_select_event_mask(struct tb_context* ctx, int mask);
+int tb_ctx_select_output_mode(struct tb_context* ctx, int mode);
+int tb_ctx_peek_event(struct tb_context* ctx, struct tb_event* event, int timeout);
+int tb_ctx_poll_event(struct tb_context* ctx, struct tb_event* event);
+int tb_ctx_poll_events(struct tb_context* ctx, struct tb_event* events, int max, int timeout);
+int tb_ctx_get_fds(struct tb_context* ctx, int* in_fd, int* out_fd, int* resize_fd);
+int tb_ctx_process_input(struct tb_context* ctx, const char* data, int len);
+int tb_ctx_next_event(struct tb_context* ctx, struct tb_event* event);
+int tb_ctx_next_timeout(struct tb_context* ctx);
+int tb_ctx_record_start(struct tb_context* ctx, const char* path);
+void tb_ctx_record_stop(struct tb_context* ctx);
+int tb_ctx_replay(struct tb_context* ctx, const char* path, int flags,
+    tb_replay_handler_t handler, void* arg);
+
+void tb_ctx_char(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg, uint32_t ch);
+int tb_ctx_string_with_limit(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg,
+    const char * str, int limit);
+int tb_ctx_string(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg, const char *str);
+int tb_ctx_stringf(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg,
+    const char * fmt, ...);
+int tb_ctx_vstringf(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg,
+    const char * fmt, va_list ap);
+void tb_ctx_empty(struct tb_context* ctx, int x, int y, uint32_t bg, int width);
+int tb_ctx_number(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg, int width,
+    int64_t value, int flags);
+int tb_ctx_fixed(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg, int width,
+    int64_t value, int decimals, int flags);
+int tb_ctx_si(struct tb_context* ctx, int x, int y, uint32_t fg, uint32_t bg, int width,
+    int64_t value, int decimals, int flags);
+uint32_t tb_ctx_rgb(struct tb_context* ctx, uint32_t in);
+int tb_ctx_blit_rgb(struct tb_context* ctx, int x, int y, int w, int h, const uint32_t* pixels,
+    int stride, int mode);
+int tb_ctx_layout_draw(struct tb_context* ctx, const struct tb_layout* layout, int x, int y,
+    int height, int first, uint32_t fg, uint32_t bg);
+
+void tb_ctx_get_mem_stats(struct tb_context* ctx, struct tb_mem_stats* stats);
+void tb_ctx_get_latency_stats(struct tb_context* ctx, struct tb_latency_stats* stats);
+void tb_ctx_reset_latency_stats(struct tb_context* ctx);
 
 // c++
 #ifdef __cplusplus
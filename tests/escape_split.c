@@ -0,0 +1,222 @@
+/*
+ * Torture test of the input parser on a Linux host: every sequence of the
+ * corpus is fed through tb_ctx_process_input() split at every byte boundary,
+ * and once byte by byte, and must give the same events as when it is fed in
+ * one piece. Events are taken with the escape timeout never expiring between
+ * the pieces, and with it expired once all the input is in. Some of them
+ * must also give the events listed in expected[].
+ */
+#include "../termbox.c"
+
+#include <pty.h>
+#include <stdio.h>
+
+#define SPLIT_EVENTS_MAX 1024
+
+static const char* corpus[] =
+{
+    // plain keys and UTF-8
+    "a", "\x7f", "\r", "\t", "\xc3\xa9", "\xe4\xb8\xad", "\xf0\x9f\x98\x80",
+    "\xff", "\xe4\xb8",
+
+    // ESC and ALT
+    "\033", "\033\033", "\033a", "\033\xc3\xa9", "\033\033[A", "\033O", "\033Ox",
+    "\033[", "\033[1;", "\033]", "\033P", "\033_", "\033^", "\033X",
+
+    // CSI and SS3 keys, with modifiers
+    "\033[1;5A", "\033[1;2P", "\033[1;5R", "\033[15;3~", "\033[Z", "\033O2P",
+    "\033[3;5~", "\033[200;1~",
+
+    // kitty keyboard protocol and modifyOtherKeys
+    "\033[97u", "\033[97;5u", "\033[97;1:3u", "\033[27;5;97~", "\033[57399u",
+
+    // mouse
+    "\033[<0;10;20M", "\033[<0;10;20m", "\033[<64;3;4M", "\033[<35;7;8M",
+    "\033[32;10;20M", "\033[M !!", "\033[M#*+",
+
+    // bracketed paste
+    "\033[200~hello\033[201~", "\033[200~a\033b\033[201~", "\033[200~\033[201~",
+
+    // strings, which are swallowed
+    "\033]0;title\007", "\033]11;rgb:0000/0000/0000\033\\", "\033P1$r0m\033\\",
+    "\033_Gi=1;OK\033\\",
+
+    // unknown sequences
+    "\033[?1;2c", "\033[>0;276;0c", "\033[999X", "\033[1;2;3;4;5;6;7;8;9;10;11;12;13;14;15;16;17q",
+    RT_NULL
+};
+
+// what some of them must give, as "[type mod key ch x,y wxh]" per event
+static const struct
+{
+    int mode;
+    const char* seq;
+    const char* events;
+} expected[] =
+{
+    {TB_INPUT_ESC, "\033OP", "[1 00 ffff 0 0,0 0x0]"},
+    {TB_INPUT_ESC, "\033[1;5R", "[1 08 fffd 0 0,0 0x0]"},
+    {TB_INPUT_ESC, "\033Ox", "[1 00 001b 0 0,0 0x0][1 00 0000 4f 0,0 0x0][1 00 0000 78 0,0 0x0]"},
+    {TB_INPUT_ALT, "\033Ox", "[1 01 0000 4f 0,0 0x0][1 00 0000 78 0,0 0x0]"},
+    {TB_INPUT_ALT, "\033]", "[1 01 0000 5d 0,0 0x0]"},
+    {TB_INPUT_ALT, "\033]0;title\007x", "[1 00 0000 78 0,0 0x0]"},
+    {0, RT_NULL, RT_NULL}
+};
+
+static const int input_modes[] =
+{
+    TB_INPUT_ESC | TB_INPUT_MOUSE | TB_INPUT_PASTE,
+    TB_INPUT_ALT | TB_INPUT_MOUSE | TB_INPUT_PASTE,
+};
+
+static char* event_append(char* out, char* end, const struct tb_event* ev)
+{
+    int n = snprintf(out, end - out, "[%u %02x %04x %x %d,%d %dx%d",
+        ev->type, ev->mod, ev->key, (unsigned int)ev->ch, (int)ev->x, (int)ev->y,
+        (int)ev->w, (int)ev->h);
+
+    out += n < end - out ? n : end - out;
+    if (ev->type == TB_EVENT_PASTE && out < end)
+    {
+        n = snprintf(out, end - out, " '%.*s'", (int)ev->len, ev->data);
+        out += n < end - out ? n : end - out;
+    }
+
+    if (out < end)
+    {
+        n = snprintf(out, end - out, "]");
+        out += n < end - out ? n : end - out;
+    }
+
+    return out;
+}
+
+static char* take_events(struct tb_context* ctx, char* out, char* end, rt_bool_t flush)
+{
+    struct tb_event ev;
+
+    while (next_event(ctx, &ev, flush) == RT_TRUE)
+    {
+        out = event_append(out, end, &ev);
+    }
+
+    return out;
+}
+
+// feed 'seq' in pieces of the lengths in 'cuts', the last one takes the rest
+static void parse_split(struct tb_context* ctx, const char* seq, const int* cuts, int ncuts,
+    char* out, size_t size)
+{
+    char* end = out + size;
+    int len = strlen(seq);
+    int off = 0, i, n;
+
+    *out = '\0';
+    for (i = 0; i <= ncuts; i++)
+    {
+        n = i < ncuts ? cuts[i] : len - off;
+        if (tb_ctx_process_input(ctx, seq + off, n) != n)
+        {
+            snprintf(out, size, "input not taken");
+            return;
+        }
+
+        off += n;
+        out = take_events(ctx, out, end, RT_FALSE);
+    }
+
+    take_events(ctx, out, end, RT_TRUE);
+}
+
+static int check(struct tb_context* ctx, const char* seq, const char* want,
+    const int* cuts, int ncuts)
+{
+    char got[SPLIT_EVENTS_MAX];
+    int i;
+
+    parse_split(ctx, seq, cuts, ncuts, got, sizeof(got));
+    if (strcmp(got, want) == 0)
+    {
+        return 0;
+    }
+
+    printf("FAIL ");
+    for (i = 0; seq[i]; i++)
+    {
+        printf(seq[i] >= 0x20 && seq[i] < 0x7f ? "%c" : "\\x%02x", (unsigned char)seq[i]);
+    }
+    printf(" cut");
+    for (i = 0; i < ncuts; i++)
+    {
+        printf(" %d", cuts[i]);
+    }
+    printf("\n  want: %s\n  got:  %s\n", want, got);
+    return 1;
+}
+
+int main(void)
+{
+    struct winsize ws = {24, 80, 0, 0};
+    struct tb_context* ctx;
+    char seq[64], want[SPLIT_EVENTS_MAX];
+    int ones[64];
+    int master, slave, m, c, k, cut, len;
+    int cases = 0, errors = 0;
+
+    if (openpty(&master, &slave, RT_NULL, RT_NULL, &ws) != 0)
+    {
+        return 1;
+    }
+
+    ctx = tb_ctx_init(slave, slave);
+    if (ctx == RT_NULL)
+    {
+        return 1;
+    }
+
+    for (k = 0; k < 64; k++)
+    {
+        ones[k] = 1;
+    }
+
+    for (m = 0; m < (int)(sizeof(input_modes) / sizeof(input_modes[0])); m++)
+    {
+        tb_ctx_select_input_mode(ctx, input_modes[m]);
+
+        // each sequence alone, and followed by a key
+        for (c = 0; corpus[c] != RT_NULL; c++)
+        {
+            for (k = 0; k < 2; k++)
+            {
+                snprintf(seq, sizeof(seq), "%s%s", corpus[c], k ? "z" : "");
+                len = strlen(seq);
+
+                parse_split(ctx, seq, RT_NULL, 0, want, sizeof(want));
+
+                for (cut = 1; cut < len; cut++)
+                {
+                    errors += check(ctx, seq, want, &cut, 1);
+                    cases++;
+                }
+
+                errors += check(ctx, seq, want, ones, len - 1);
+                cases++;
+            }
+        }
+    }
+
+    for (c = 0; expected[c].seq != RT_NULL; c++)
+    {
+        tb_ctx_select_input_mode(ctx, expected[c].mode);
+        errors += check(ctx, expected[c].seq, expected[c].events, RT_NULL, 0);
+        cases++;
+    }
+
+    tb_ctx_shutdown(ctx);
+    close(master);
+    close(slave);
+
+    printf("%d cases, %d failed\n", cases, errors);
+    printf("%s\n", errors ? "FAIL" : "PASS");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1 @@
+#include <wchar.h>
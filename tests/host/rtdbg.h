@@ -0,0 +1,11 @@
+#ifndef __RTDBG_HOST_H__
+#define __RTDBG_HOST_H__
+
+#include <stdio.h>
+
+#define LOG_E(...) do { fprintf(stderr, "[E/" DBG_TAG "] " __VA_ARGS__); fputc('\n', stderr); } while (0)
+#define LOG_W(...) do { fprintf(stderr, "[W/" DBG_TAG "] " __VA_ARGS__); fputc('\n', stderr); } while (0)
+#define LOG_I(...) do { } while (0)
+#define LOG_D(...) do { } while (0)
+
+#endif /* __RTDBG_HOST_H__ */
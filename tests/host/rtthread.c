@@ -0,0 +1,166 @@
+#include <errno.h>
+#include <time.h>
+#include "rtthread.h"
+
+rt_tick_t rt_tick_get(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (rt_tick_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+rt_tick_t rt_tick_from_millisecond(rt_int32_t ms)
+{
+    return ms;
+}
+
+rt_sem_t rt_sem_create(const char* name, rt_uint32_t value, rt_uint8_t flag)
+{
+    rt_sem_t sem = malloc(sizeof(struct rt_semaphore));
+
+    (void)name;
+    (void)flag;
+    if (sem != RT_NULL)
+    {
+        sem_init(&sem->sem, 0, value);
+    }
+
+    return sem;
+}
+
+rt_err_t rt_sem_delete(rt_sem_t sem)
+{
+    sem_destroy(&sem->sem);
+    free(sem);
+    return RT_EOK;
+}
+
+rt_err_t rt_sem_take(rt_sem_t sem, rt_int32_t time)
+{
+    struct timespec ts;
+    int ret;
+
+    if (time == RT_WAITING_FOREVER)
+    {
+        while ((ret = sem_wait(&sem->sem)) != 0 && errno == EINTR);
+        return ret == 0 ? RT_EOK : -RT_ERROR;
+    }
+
+    if (time == RT_WAITING_NO)
+    {
+        return sem_trywait(&sem->sem) == 0 ? RT_EOK : -RT_ETIMEOUT;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += time / 1000;
+    ts.tv_nsec += (time % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    while ((ret = sem_timedwait(&sem->sem, &ts)) != 0 && errno == EINTR);
+    return ret == 0 ? RT_EOK : -RT_ETIMEOUT;
+}
+
+rt_err_t rt_sem_release(rt_sem_t sem)
+{
+    sem_post(&sem->sem);
+    return RT_EOK;
+}
+
+rt_mutex_t rt_mutex_create(const char* name, rt_uint8_t flag)
+{
+    rt_mutex_t mutex = malloc(sizeof(struct rt_mutex));
+
+    (void)name;
+    (void)flag;
+    if (mutex != RT_NULL)
+    {
+        pthread_mutex_init(&mutex->mutex, RT_NULL);
+    }
+
+    return mutex;
+}
+
+rt_err_t rt_mutex_delete(rt_mutex_t mutex)
+{
+    pthread_mutex_destroy(&mutex->mutex);
+    free(mutex);
+    return RT_EOK;
+}
+
+rt_err_t rt_mutex_take(rt_mutex_t mutex, rt_int32_t time)
+{
+    (void)time;
+    pthread_mutex_lock(&mutex->mutex);
+    return RT_EOK;
+}
+
+rt_err_t rt_mutex_release(rt_mutex_t mutex)
+{
+    pthread_mutex_unlock(&mutex->mutex);
+    return RT_EOK;
+}
+
+static void* thread_trampoline(void* parameter)
+{
+    rt_thread_t thread = parameter;
+
+    thread->entry(thread->parameter);
+    free(thread);
+    return RT_NULL;
+}
+
+rt_thread_t rt_thread_create(const char* name, void (*entry)(void* parameter), void* parameter,
+    rt_uint32_t stack_size, rt_uint8_t priority, rt_uint32_t tick)
+{
+    rt_thread_t thread = malloc(sizeof(struct rt_thread));
+
+    (void)name;
+    (void)stack_size;
+    (void)priority;
+    (void)tick;
+    if (thread != RT_NULL)
+    {
+        thread->entry = entry;
+        thread->parameter = parameter;
+    }
+
+    return thread;
+}
+
+rt_err_t rt_thread_startup(rt_thread_t thread)
+{
+    if (pthread_create(&thread->tid, RT_NULL, thread_trampoline, thread) != 0)
+    {
+        return -RT_ERROR;
+    }
+
+    pthread_detach(thread->tid);
+    return RT_EOK;
+}
+
+rt_err_t rt_thread_mdelay(rt_int32_t ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&ts, RT_NULL);
+    return RT_EOK;
+}
+
+static pthread_mutex_t critical = PTHREAD_MUTEX_INITIALIZER;
+
+void rt_enter_critical(void)
+{
+    pthread_mutex_lock(&critical);
+}
+
+void rt_exit_critical(void)
+{
+    pthread_mutex_unlock(&critical);
+}
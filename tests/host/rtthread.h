@@ -0,0 +1,89 @@
+/*
+ * The part of the RT-Thread API termbox uses, on top of POSIX threads, so
+ * that the tests in this directory run on a Linux host. See rtthread.c.
+ */
+#ifndef __RTTHREAD_HOST_H__
+#define __RTTHREAD_HOST_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+typedef int                 rt_bool_t;
+typedef long                rt_err_t;
+typedef int32_t             rt_int32_t;
+typedef uint8_t             rt_uint8_t;
+typedef uint32_t            rt_uint32_t;
+typedef uint32_t            rt_tick_t;
+
+#define RT_NULL             NULL
+#define RT_TRUE             1
+#define RT_FALSE            0
+#define RT_EOK              0
+#define RT_ERROR            1
+#define RT_ETIMEOUT         2
+#define RT_WAITING_FOREVER  -1
+#define RT_WAITING_NO       0
+#define RT_IPC_FLAG_FIFO    0x00
+#define RT_IPC_FLAG_PRIO    0x01
+#define RT_TICK_PER_SECOND  1000
+#define RT_THREAD_PRIORITY_MAX 32
+#define RT_CONSOLEBUF_SIZE  128
+#define RT_SERIAL_RB_BUFSZ  64
+#define RT_TICK_MAX         0xFFFFFFFF
+
+#define rt_inline           static __inline
+
+#define rt_malloc           malloc
+#define rt_realloc          realloc
+#define rt_free             free
+#define rt_memset           memset
+#define rt_memcpy           memcpy
+#define rt_kprintf          printf
+#define rt_sprintf          sprintf
+
+struct rt_semaphore
+{
+    sem_t sem;
+};
+typedef struct rt_semaphore* rt_sem_t;
+
+struct rt_mutex
+{
+    pthread_mutex_t mutex;
+};
+typedef struct rt_mutex* rt_mutex_t;
+
+struct rt_thread
+{
+    pthread_t tid;
+    void (*entry)(void* parameter);
+    void* parameter;
+};
+typedef struct rt_thread* rt_thread_t;
+
+rt_tick_t rt_tick_get(void);
+rt_tick_t rt_tick_from_millisecond(rt_int32_t ms);
+
+rt_sem_t rt_sem_create(const char* name, rt_uint32_t value, rt_uint8_t flag);
+rt_err_t rt_sem_delete(rt_sem_t sem);
+rt_err_t rt_sem_take(rt_sem_t sem, rt_int32_t time);
+rt_err_t rt_sem_release(rt_sem_t sem);
+
+rt_mutex_t rt_mutex_create(const char* name, rt_uint8_t flag);
+rt_err_t rt_mutex_delete(rt_mutex_t mutex);
+rt_err_t rt_mutex_take(rt_mutex_t mutex, rt_int32_t time);
+rt_err_t rt_mutex_release(rt_mutex_t mutex);
+
+rt_thread_t rt_thread_create(const char* name, void (*entry)(void* parameter), void* parameter,
+    rt_uint32_t stack_size, rt_uint8_t priority, rt_uint32_t tick);
+rt_err_t rt_thread_startup(rt_thread_t thread);
+rt_err_t rt_thread_mdelay(rt_int32_t ms);
+
+void rt_enter_critical(void);
+void rt_exit_critical(void);
+
+#endif /* __RTTHREAD_HOST_H__ */
@@ -0,0 +1,151 @@
+/*
+ * Stress test of the input ring on a Linux host: a producer and a consumer
+ * thread push and pop chunks of random sizes at the same time, without any
+ * lock, the way the input thread (or a UART RX interrupt) and the parser do.
+ *
+ * The producer writes a running byte counter and only advances it by what
+ * ringbuffer_push() accepted, so the consumer must see the counter without
+ * a gap, and every byte which did not fit must be counted in 'dropped'.
+ * Build it with -fsanitize=thread to check the acquire/release ordering as
+ * well, see README.md.
+ */
+#include "../termbox.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define STRESS_RING_SIZE 64
+#define STRESS_BYTES     (1024u * 1024)
+#define STRESS_CHUNK     24
+
+static struct ringbuffer ring;
+static size_t producer_done;
+static size_t attempted;
+static size_t accepted;
+
+// let the other side run, also on a single core host
+static void stress_pause(void)
+{
+    struct timespec ts = {0, 1000};
+
+    nanosleep(&ts, RT_NULL);
+}
+
+static unsigned stress_rand(unsigned* seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 16;
+}
+
+static void* producer(void* arg)
+{
+    unsigned seed = 1;
+    unsigned char chunk[STRESS_CHUNK];
+    unsigned char next = 0;
+    size_t i, n, pushed;
+
+    (void)arg;
+    while (accepted < STRESS_BYTES)
+    {
+        n = stress_rand(&seed) % STRESS_CHUNK + 1;
+
+        for (i = 0; i < n; i++)
+        {
+            chunk[i] = (unsigned char)(next + i);
+        }
+
+        pushed = ringbuffer_push(&ring, chunk, n);
+        next += pushed;
+        attempted += n;
+        accepted += pushed;
+
+        if (pushed < n)
+        {
+            stress_pause();
+        }
+    }
+
+    RB_STORE_RELEASE(&producer_done, 1);
+    return RT_NULL;
+}
+
+int main(void)
+{
+    pthread_t tid;
+    unsigned seed = 2;
+    unsigned char chunk[STRESS_CHUNK];
+    unsigned char expected = 0;
+    size_t received = 0;
+    size_t i, n, size;
+    int errors = 0;
+
+    if (init_ringbuffer(&ring, STRESS_RING_SIZE) != 0)
+    {
+        return 1;
+    }
+
+    pthread_create(&tid, RT_NULL, producer, RT_NULL);
+
+    while (1)
+    {
+        // read before the size: once it is set, all the data is visible
+        int done = RB_LOAD_ACQUIRE(&producer_done) != 0;
+
+        size = ringbuffer_data_size(&ring);
+        if (size == 0)
+        {
+            if (done)
+            {
+                break;
+            }
+
+            stress_pause();
+            continue;
+        }
+
+        n = stress_rand(&seed) % STRESS_CHUNK + 1;
+        if (n > size)
+        {
+            n = size;
+        }
+
+        // the parser looks at bytes before it consumes them
+        if (ringbuffer_at(&ring, 0) != (char)expected)
+        {
+            errors++;
+        }
+
+        ringbuffer_pop(&ring, chunk, n);
+
+        for (i = 0; i < n; i++, expected++)
+        {
+            if (chunk[i] != expected)
+            {
+                if (errors++ < 10)
+                {
+                    printf("byte %u: got %u, expected %u\n", (unsigned int)(received + i),
+                        chunk[i], expected);
+                }
+                expected = chunk[i];
+            }
+        }
+
+        received += n;
+    }
+
+    pthread_join(tid, RT_NULL);
+
+    printf("attempted %u, accepted %u, received %u, dropped %u, high water %u/%u\n",
+        (unsigned int)attempted, (unsigned int)accepted, (unsigned int)received,
+        (unsigned int)ring.dropped, (unsigned int)ring.high_water, (unsigned int)ring.size);
+
+    if (received != accepted || ring.dropped != attempted - accepted ||
+        ring.high_water > ring.size)
+    {
+        errors++;
+    }
+
+    free_ringbuffer(&ring);
+    printf("%s\n", errors ? "FAIL" : "PASS");
+    return errors ? 1 : 0;
+}